@@ -51,12 +51,12 @@ public:
 	}
 
 	//Takes a 2D offset in the array and converts it to the equivalent 1D offset
-	inline int To1DOffset(int x, int y) { return (y * XSize) + x; }
+	inline int To1DOffset(int x, int y) { return (y * _Width) + x; }
 	//Takes a 1D offset in the array and finds the equivalent 2D offset
 	inline void To2DOffset(int oneDOffset, int& outX, int& outY)
 	{
 		outY = oneDOffset / _Width;
-		outX = oneDOffset - (y * _Width);
+		outX = oneDOffset - (outY * _Width);
 	}
 
 	//Checks that a value is within the bounds of the array
@@ -82,7 +82,7 @@ public:
 	inline T& operator[](int oneDIndex) {
 		if (DoBoundsChecks) {
 			int x, y;
-			To2DOffset(oneDIndex, &x, &y);
+			To2DOffset(oneDIndex, x, y);
 			assert(InBounds(x, y));
 		}
 		return _First[oneDIndex];
@@ -0,0 +1,135 @@
+#include "AsyncDecoder.h"
+#include "Decoder.h"
+
+AsyncDecoder::AsyncDecoder(int width, int height, Scheduler & scheduler, ReferenceSet * references) : _Scheduler(scheduler), _References(references)
+{
+	_Image = new CompressedImage(width, height);
+}
+
+AsyncDecoder::~AsyncDecoder()
+{
+	WaitForIdle();
+	delete _Image;
+}
+
+AsyncDecoder::FrameHandle AsyncDecoder::SubmitFrame(uint8_t * serializedData, const OutputSurface & surface, FrameCallback onFrameDecoded)
+{
+	QueuedFrame* queued = new QueuedFrame();
+	queued->Data = serializedData;
+	queued->Surface = surface;
+	queued->OnFrameDecoded = onFrameDecoded;
+	return Queue(queued);
+}
+
+AsyncDecoder::FrameHandle AsyncDecoder::SubmitFrame(std::vector<uint8_t> serializedFrame, const OutputSurface & surface, FrameCallback onFrameDecoded)
+{
+	QueuedFrame* queued = new QueuedFrame();
+	queued->Owned = std::move(serializedFrame);
+	queued->Data = queued->Owned.data();
+	queued->Surface = surface;
+	queued->OnFrameDecoded = onFrameDecoded;
+	return Queue(queued);
+}
+
+AsyncDecoder::FrameHandle AsyncDecoder::Queue(QueuedFrame * frame)
+{
+	FrameHandle handle = frame->Done.get_future().share();
+	frame->Scale = _Scale;
+	frame->KeepSurface = _KeepSurfaces;
+
+	std::unique_lock<std::mutex> lock(_Mutex);
+	_Frames.push_back(std::unique_ptr<QueuedFrame>(frame));
+	//Otherwise it's started when the frames ahead of it are done
+	if (_Frames.size() == 1)
+		StartFrame();
+	return handle;
+}
+
+void AsyncDecoder::StartFrame()
+{
+	_Scheduler.Enqueue(&AsyncDecoder::Deserialize, this, _Frames.front().get());
+}
+
+void AsyncDecoder::Deserialize(QueuedFrame * frame)
+{
+	//Reading the frame is sequential, but then every tile can be written out at once
+	Decoder::DeserializeImage(*_Image, frame->Data, _References);
+
+	std::vector<Decoder::Tile> tiles;
+	if (frame->KeepSurface && frame->Scale == 1)
+		Decoder::FindChangedTiles(*_Image, frame->Surface, KeptSurfaceVersions(frame->Surface), tiles);
+	else {
+		//Anything kept in the surface is overwritten
+		if (frame->KeepSurface)
+			KeptSurfaceVersions(frame->Surface).clear();
+		//Scaled frames are small enough to be decoded a row at a time
+		int tileRegions = frame->Scale > 1 ? _Image->RegionsWide() : Decoder::TileRegionsWide(*_Image, frame->Surface);
+		for (int y = 0; y < _Image->RegionsTall(); y++)
+			for (int x = 0; x < _Image->RegionsWide(); x += tileRegions) {
+				int regionCount = _Image->RegionsWide() - x < tileRegions ? _Image->RegionsWide() - x : tileRegions;
+				tiles.push_back(Decoder::Tile{ x, y, regionCount });
+			}
+	}
+
+	std::unique_lock<std::mutex> lock(_Mutex);
+	_TilesRemaining = (int)tiles.size();
+	for (size_t i = 0; i < tiles.size(); i++)
+		_Scheduler.Enqueue(&AsyncDecoder::DecodeTile, this, frame, tiles[i].RegionX, tiles[i].RegionY, tiles[i].RegionCount);
+	//Nothing changed, so the surface is up to date already
+	if (tiles.empty()) {
+		lock.unlock();
+		FinishFrame(frame);
+	}
+}
+
+std::vector<uint32_t>& AsyncDecoder::KeptSurfaceVersions(const OutputSurface & surface)
+{
+	for (size_t i = 0; i < _KeptSurfaces.size(); i++) {
+		KeptSurface& kept = _KeptSurfaces[i];
+		if (kept.Surface.Data != surface.Data)
+			continue;
+		//The same data laid out differently is a new surface
+		if (kept.Surface.Format != surface.Format || kept.Surface.Stride != surface.Stride || kept.Surface.Width != surface.Width || kept.Surface.Height != surface.Height) {
+			kept.Surface = surface;
+			kept.Versions.clear();
+		}
+		return kept.Versions;
+	}
+	_KeptSurfaces.push_back(KeptSurface{ surface, std::vector<uint32_t>() });
+	return _KeptSurfaces.back().Versions;
+}
+
+void AsyncDecoder::DecodeTile(QueuedFrame * frame, int regionX, int regionY, int regionCount)
+{
+	if (frame->Scale > 1)
+		Decoder::DecodeRegionRowScaled(*_Image, regionY, frame->Surface, frame->Scale);
+	else
+		Decoder::DecodeTile(*_Image, regionX, regionY, regionCount, frame->Surface);
+
+	std::unique_lock<std::mutex> lock(_Mutex);
+	//The last tile to finish completes the frame
+	if (--_TilesRemaining == 0) {
+		lock.unlock();
+		FinishFrame(frame);
+	}
+}
+
+void AsyncDecoder::FinishFrame(QueuedFrame * frame)
+{
+	if (frame->OnFrameDecoded)
+		frame->OnFrameDecoded(*_Image, frame->Surface);
+	frame->Done.set_value();
+
+	std::unique_lock<std::mutex> lock(_Mutex);
+	_Frames.pop_front();
+	if (!_Frames.empty())
+		StartFrame();
+	else
+		_Idle.notify_all();
+}
+
+void AsyncDecoder::WaitForIdle()
+{
+	std::unique_lock<std::mutex> lock(_Mutex);
+	_Idle.wait(lock, [this] { return _Frames.empty(); });
+}
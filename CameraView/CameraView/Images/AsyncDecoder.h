@@ -0,0 +1,94 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+#include <future>
+#include <stdint.h>
+#include "CompressedImage.h"
+#include "OutputFormats.h"
+#include "ReferenceSet.h"
+#include "..\Scheduler.h"
+
+//Decodes a stream of serialized frames on the shared scheduler without blocking the caller.
+//
+//Frames are decoded in submission order, one at a time: each frame is deserialized on top of the previous one (the
+//regions it leaves out are kept), so the next frame can't be deserialized until the current one has been written out.
+//Within a frame the tiles of the surface are decoded in parallel. The caller is free to receive the next frame meanwhile.
+//Streams which use long-term references need a ReferenceSet with the same settings as the encoder's.
+//
+//Surfaces which are kept from frame to frame (see KeepSurfaces()) only have the regions which changed since they were
+//last decoded to written, so the cost follows the bitrate rather than the resolution.
+class AsyncDecoder
+{
+public:
+	//Called on a worker thread when a frame has been decoded into its surface
+	typedef std::function<void(CompressedImage& image, const OutputSurface& surface)> FrameCallback;
+	//Becomes ready once the frame has been decoded (after its callback has run)
+	typedef std::shared_future<void> FrameHandle;
+private:
+	struct QueuedFrame {
+		uint8_t* Data;
+		//Holds the data if the frame was handed over by value
+		std::vector<uint8_t> Owned;
+		OutputSurface Surface;
+		//1 for a full size decode, otherwise the scale of a scaled one
+		int Scale;
+		bool KeepSurface;
+		FrameCallback OnFrameDecoded;
+		std::promise<void> Done;
+	};
+
+	Scheduler& _Scheduler;
+	CompressedImage* _Image;
+	ReferenceSet* _References;
+	//Frames not yet decoded, the one being decoded first
+	std::deque<std::unique_ptr<QueuedFrame>> _Frames;
+	int _TilesRemaining = 0;
+	int _Scale = 1;
+	bool _KeepSurfaces = false;
+	struct KeptSurface {
+		OutputSurface Surface;
+		//The region versions the surface is up to date with (see Decoder::DecodeChangedRegions())
+		std::vector<uint32_t> Versions;
+	};
+	//The kept surfaces decoded to so far. Only used while deserializing, which is one frame at a time.
+	std::vector<KeptSurface> _KeptSurfaces;
+	std::mutex _Mutex;
+	std::condition_variable _Idle;
+
+	FrameHandle Queue(QueuedFrame* frame);
+	//Starts on the oldest frame. Must hold _Mutex.
+	void StartFrame();
+	void Deserialize(QueuedFrame* frame);
+	//Gets the versions of a kept surface, which start out empty (out of date everywhere) for a new one
+	std::vector<uint32_t>& KeptSurfaceVersions(const OutputSurface& surface);
+	void DecodeTile(QueuedFrame* frame, int regionX, int regionY, int regionCount);
+	void FinishFrame(QueuedFrame* frame);
+public:
+	//Streams which use long-term references need the decoder's set of them, created with the same settings as the
+	//encoder's References()
+	AsyncDecoder(int width, int height, Scheduler& scheduler = CompressedImage::Pool(), ReferenceSet* references = nullptr);
+	//Waits for all the submitted frames to be decoded
+	~AsyncDecoder();
+
+	//Queues a frame for decoding and returns right away. The serialized data and the surface must stay valid until
+	//the frame has been decoded.
+	FrameHandle SubmitFrame(uint8_t* serializedData, const OutputSurface& surface, FrameCallback onFrameDecoded = nullptr);
+	//Queues a frame for decoding, taking ownership of its serialized data
+	FrameHandle SubmitFrame(std::vector<uint8_t> serializedFrame, const OutputSurface& surface, FrameCallback onFrameDecoded = nullptr);
+
+	//Decodes the frames submitted from now on at 1/2, 1/4 or 1/8 of their size (2, 4 or 8) -- see
+	//Decoder::DecodeImageScaled(). 1 decodes them at full size.
+	inline int& Scale() { return _Scale; }
+	//Whether the surfaces of the frames submitted from now on keep their contents from frame to frame, so only the
+	//regions which changed since a surface was last decoded to need writing. Surfaces are told apart by their data, so
+	//a buffer which is reused for something else in between has to be given a different one. Scaled frames are always
+	//decoded in full.
+	inline bool& KeepSurfaces() { return _KeepSurfaces; }
+
+	//Blocks until every submitted frame has been decoded
+	void WaitForIdle();
+};
@@ -0,0 +1,69 @@
+#pragma once
+#include <stdint.h>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include "RGB565Color.h"
+
+//A 32 bit color, used for the pixels blocks are built from. Unlike the packed 24 bit BGRColor, every pixel is 4 byte
+//aligned, so the block kernels can load a whole pixel at once.
+class BGRAColor
+{
+private:
+	//Stored as BGRA to match the usual 32 bit capture and display formats
+	uint8_t _B, _G, _R, _A;
+public:
+	inline uint8_t R() { return _R; }
+	inline uint8_t G() { return _G; }
+	inline uint8_t B() { return _B; }
+	inline uint8_t A() { return _A; }
+
+	BGRAColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 255)
+	{
+		_R = r;
+		_G = g;
+		_B = b;
+		_A = a;
+	}
+
+	BGRAColor() {}
+
+	inline static BGRAColor Blend(BGRAColor color1, BGRAColor color2, float distance) {
+		auto r = (uint8_t)((color1._R * (1 - distance) + color2._R * distance));
+		auto g = (uint8_t)((color1._G * (1 - distance) + color2._G * distance));
+		auto b = (uint8_t)((color1._B * (1 - distance) + color2._B * distance));
+
+		return BGRAColor(r, g, b);
+	}
+
+	//Computes the distance between 2 colors -- lower is more similar. Alpha is ignored.
+	inline static int DistanceAbs(BGRAColor color1, BGRAColor color2) {
+		int dist = 0;
+		dist += abs(color1._R - color2._R);
+		dist += abs(color1._G - color2._G);
+		dist += abs(color1._B - color2._B);
+
+		return dist;
+	}
+
+	//Computes the distance between 2 colors -- 0 is the same, positive means color 2 is darker than color 1, negative means color 2 is lighter than color 1
+	inline static int Distance(BGRAColor color1, BGRAColor color2) {
+		int dist = 0;
+		dist += color1._R - color2._R;
+		dist += color1._G - color2._G;
+		dist += color1._B - color2._B;
+
+		return dist;
+	}
+
+	std::string ToString() {
+		std::ostringstream stream;
+		stream << "{R:" << (int)R() << ",G:" << (int)G() << ",B:" << (int)B() << ",A:" << (int)A() << "}";
+		return stream.str();
+	}
+
+	//Creates an RGB 565 compressed color from a 32 bit color
+	inline RGB565Color To565() { return RGB565Color(R(), G(), B()); }
+	//Creates a 32 bit color from a 565 formatted color
+	inline static BGRAColor From565(RGB565Color color) { return BGRAColor(color.R(), color.G(), color.B()); }
+};
@@ -0,0 +1,82 @@
+#include "BatchEncoder.h"
+#include <algorithm>
+
+BatchEncoder::BatchEncoder(int width, int height, FrameCallback onFrameEncoded, int batchSize, int similarityThreshold) :
+	_Encoder(width, height, similarityThreshold), _OnFrameEncoded(onFrameEncoded)
+{
+	//4 rows a thread keeps them all busy to the end of the batch, give or take
+	if (batchSize <= 0)
+		batchSize = std::max(1, (CompressedImage::Pool().ThreadCount() * 4 + _Encoder.RegionsTall() - 1) / _Encoder.RegionsTall());
+	_BatchSize = batchSize;
+	for (auto& batch : _Batches) {
+		batch.Pixels.resize(_BatchSize);
+		for (int i = 0; i < _BatchSize; i++)
+			batch.Built.push_back(std::unique_ptr<CompressedImage>(new CompressedImage(width, height)));
+	}
+}
+
+BatchEncoder::~BatchEncoder()
+{
+	Flush();
+}
+
+void BatchEncoder::SubmitFrame(const BGRColor * colorData)
+{
+	Batch& batch = _Batches[_Filling];
+	batch.Pixels[batch.Count++].assign(colorData, colorData + _Encoder.Width() * _Encoder.Height());
+	if (batch.Count < _BatchSize)
+		return;
+
+	//The full batch is built while the one before it is encoded, then filling goes on in that one
+	StartBatch(batch);
+	_Filling ^= 1;
+	if (_Batches[_Filling].Building)
+		EncodeBatch(_Batches[_Filling]);
+}
+
+void BatchEncoder::Flush()
+{
+	Batch& filling = _Batches[_Filling];
+	if (filling.Count > 0)
+		StartBatch(filling);
+	//The other batch was started first
+	if (_Batches[_Filling ^ 1].Building)
+		EncodeBatch(_Batches[_Filling ^ 1]);
+	if (filling.Building)
+		EncodeBatch(filling);
+}
+
+void BatchEncoder::StartBatch(Batch & batch)
+{
+	batch.Building = true;
+	batch.Rows.clear();
+	for (int i = 0; i < batch.Count; i++) {
+		CompressedImage* image = batch.Built[i].get();
+		InputFrame frame = InputFrame::BGR24(batch.Pixels[i].data(), _Encoder.Width());
+		image->Adaptive() = _Encoder.AdaptiveBlockSizes();
+		image->YCoCgColors() = _Encoder.YCoCgColors();
+		for (int y = 0; y < image->RegionsTall(); y++)
+			batch.Rows.push_back(CompressedImage::Pool().Enqueue([image, frame, y] { image->SetRegionRowData(frame, y); }));
+	}
+}
+
+void BatchEncoder::EncodeBatch(Batch & batch)
+{
+	std::vector<uint8_t> serialized(_Encoder.MaxEncodedSize());
+	for (int i = 0; i < batch.Count; i++) {
+		//The rows were queued frame by frame, so the first frames are ready first
+		int rows = _Encoder.RegionsTall();
+		for (int y = 0; y < rows; y++)
+			batch.Rows[i * rows + y].wait();
+
+		int frameNumber = _Encoder.BeginFrame();
+		for (int y = 0; y < rows; y++)
+			_Encoder.EncodeRegionRow(frameNumber, *batch.Built[i], y);
+		serialized.resize(_Encoder.MaxEncodedSize());
+		serialized.resize(_Encoder.FinishFrame(frameNumber, serialized.data()));
+		if (_OnFrameEncoded)
+			_OnFrameEncoded(serialized);
+	}
+	batch.Count = 0;
+	batch.Building = false;
+}
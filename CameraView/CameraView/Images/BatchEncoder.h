@@ -0,0 +1,62 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <functional>
+#include <future>
+#include <stdint.h>
+#include "BGRColor.h"
+#include "CompressedImage.h"
+#include "StreamEncoder.h"
+
+//Encodes recorded footage as fast as the cores allow, by working on many frames at once.
+//
+//A live stream can only go one frame at a time (with a few rows of the next one overlapping), so a small frame has
+//too few rows of regions to keep a big machine busy. But building the regions -- the rearranging, block building and
+//spatial deduplication, which is most of the work -- doesn't depend on the previous frame at all. So frames are taken
+//in batches, and every row of every frame of a batch is built at once on the shared scheduler. Then a light pass on
+//the caller's thread goes through the batch in order and makes the temporal decisions (see
+//StreamEncoder::EncodeRegionRow()), while the next batch is being built.
+//
+//The frames come out byte for byte the same as a StreamEncoder with the same settings would make them, without
+//deadlines. Regions aren't known to have the same pixels as the previous frame's until it's their turn though, so with
+//SkipUnchangedRegions() they're still built: batches pay off on footage which keeps changing, or with many cores.
+class BatchEncoder
+{
+public:
+	//Called with each frame once it has been encoded, on the caller's thread
+	typedef std::function<void(std::vector<uint8_t>& serializedFrame)> FrameCallback;
+private:
+	struct Batch {
+		std::vector<std::vector<BGRColor>> Pixels;
+		std::vector<std::unique_ptr<CompressedImage>> Built;
+		//One for every row of every frame being built
+		std::vector<std::future<void>> Rows;
+		int Count = 0;
+		bool Building = false;
+	};
+
+	StreamEncoder _Encoder;
+	FrameCallback _OnFrameEncoded;
+	int _BatchSize;
+	//One batch is filled up while the other is built and encoded
+	Batch _Batches[2];
+	int _Filling = 0;
+
+	void StartBatch(Batch& batch);
+	//Waits for the batch to be built, then encodes its frames in order
+	void EncodeBatch(Batch& batch);
+public:
+	//A batch size of 0 picks enough frames for every thread of the scheduler to have several rows to build
+	BatchEncoder(int width, int height, FrameCallback onFrameEncoded, int batchSize = 0, int similarityThreshold = 768);
+	//Encodes the frames not encoded yet
+	~BatchEncoder();
+
+	inline int BatchSize() { return _BatchSize; }
+	//The encoder which makes the temporal decisions, for its settings. Change them only before the first frame.
+	inline StreamEncoder& Encoder() { return _Encoder; }
+
+	//Copies in a frame from a row-ordered RGB array. Once a batch is full, it's started and the one before it encoded.
+	void SubmitFrame(const BGRColor* colorData);
+	//Encodes every frame submitted
+	void Flush();
+};
@@ -1,67 +1,121 @@
 #include "Block.h"
+#include <cstring>
 
 
 
-void Block::FindDistinctColors(BGRColor* colorData, BGRColor* color1, BGRColor* color2)
+void Block::FindDistinctColors(BGRAColor* colorData, int count, BGRAColor* color1, BGRAColor* color2)
 {
 	//Finds the two most distinct colors in the data block
 	//You'd expect averages to be better, but somehow they're not
-	BGRColor low = BGRColor(255, 255, 255);
-	BGRColor high = BGRColor(0, 0, 0);
+	BGRAColor low = BGRAColor(255, 255, 255);
+	BGRAColor high = BGRAColor(0, 0, 0);
 
-	for (int i = 0; i < Block::PixelCount; i++) {
-		if (BGRColor::Distance(low, colorData[i]) > 0) low = colorData[i];
-		if (BGRColor::Distance(high, colorData[i]) < 0) high = colorData[i];
+	for (int i = 0; i < count; i++) {
+		if (BGRAColor::Distance(low, colorData[i]) > 0) low = colorData[i];
+		if (BGRAColor::Distance(high, colorData[i]) < 0) high = colorData[i];
 	}
 
 	*color1 = low;
 	*color2 = high;
 }
 
-void Block::ComputePixelBlending(BGRColor* colorData, BGRColor color1, BGRColor color2)
+int Block::ComputePixelBlending(BGRAColor* colorData, int count, const uint8_t* pixelIndices, BGRAColor color1, BGRAColor color2)
 {
-	BGRColor blendColors[4];
+	BGRAColor blendColors[4];
 	blendColors[0] = color1;
 	blendColors[3] = color2;
-	blendColors[1] = BGRColor::Blend(color1, color2, 0.33f);
-	blendColors[2] = BGRColor::Blend(color1, color2, 0.66f);
+	blendColors[1] = BGRAColor::Blend(color1, color2, 0.33f);
+	blendColors[2] = BGRAColor::Blend(color1, color2, 0.66f);
 
-	for (int i = 0; i < Block::PixelCount; i++) {
-		//Find the most similar color
-		PixelBlendFactor factor = PixelBlendFactor::COLOR_1;
-		int dist = BGRColor::DistanceAbs(colorData[i], blendColors[0]);
-		for (int j = 0; j < 4; j++) {
-			int localDist = BGRColor::DistanceAbs(colorData[i], blendColors[j]);
-			if (localDist < dist) {
-				factor = (Block::PixelBlendFactor)j;
-				dist = localDist;
-			}
+	//Find the most similar color for every pixel
+	static_assert(sizeof(BGRAColor) == sizeof(uint32_t), "The kernels take colors as 32 bit BGRA");
+	uint32_t palette[4];
+	memcpy(palette, blendColors, sizeof(palette));
+	uint8_t factors[PixelCount];
+	int error = Kernels::Active().ChooseBlends((const uint8_t*)colorData, count, palette, factors);
+
+	int blendValues[4];
+	for (int j = 0; j < 4; j++)
+		blendValues[j] = blendColors[j].R() + blendColors[j].G() + blendColors[j].B();
+	//YCoCg blocks keep the luma and chroma totals too
+	if (Colors == COLORS_YCOCG) {
+		for (int c = 0; c < count; c++) {
+			BGRAColor blend = blendColors[factors[c]];
+			YCoCgValues[0] += blend.R() + 2 * blend.G() + blend.B();
+			YCoCgValues[1] += blend.R() - blend.B();
+			YCoCgValues[2] += 2 * blend.G() - blend.R() - blend.B();
 		}
+	}
 
-		//And push it to the pixel data array
+	for (int c = 0; c < count; c++) {
+		int i = pixelIndices == nullptr ? c : pixelIndices[c];
+		//Push it to the pixel data array
 		int byteOffset = i / 4;
 		int shiftAmount = (i % 4) * 2;
+		PixelData[byteOffset] |= factors[c] << shiftAmount;
 
 		//And add the pixel blending
-		PixelValues += blendColors[(int)factor].R();
-		PixelValues += blendColors[(int)factor].G();
-		PixelValues += blendColors[(int)factor].B();
-
-		PixelData[byteOffset] |= factor << shiftAmount;
+		PixelValues += blendValues[factors[c]];
 	}
+	return error;
+}
+
+Block::Block(BGRAColor* colorData, ColorFormat colors) : Block(colorData, false, nullptr, colors)
+{
 }
 
-Block::Block(BGRColor* colorData)
+Block::Block(BGRAColor* colorData, bool split, int* error, ColorFormat colors)
 {
+	Colors = colors;
 	//So, blocks are processed like so:
 	//Step 1: find the two most distinct colors in the block
 	//Step 2: for each pixel, find the blend that is most similar to the original color
-	BGRColor color1, color2;
-	FindDistinctColors(colorData, &color1, &color2);
-	LowColor = color1.To565();// YUVColor::ToYUV(color1);
-	HighColor = color2.To565();// YUVColor::ToYUV(color2);
-	//Decode the 565 colors so we have the low precision versions
-	ComputePixelBlending(colorData, BGRColor::From565(LowColor), BGRColor::From565(HighColor));
+	int totalError = 0;
+	if (!split) {
+		BGRAColor color1, color2;
+		FindDistinctColors(colorData, PixelCount, &color1, &color2);
+		LowColor = EncodeColor(color1, colors);
+		HighColor = EncodeColor(color2, colors);
+		//Decode the stored colors so we have the low precision versions
+		totalError = ComputePixelBlending(colorData, PixelCount, nullptr, ToBGRA(LowColor), ToBGRA(HighColor));
+		//Every pixel on one of the colors is a solid block, whichever color it is
+		bool allLow = true, allHigh = true;
+		for (int i = 0; i < PixelDataLengthBytes; i++) {
+			allLow = allLow && PixelData[i] == 0;
+			allHigh = allHigh && PixelData[i] == 0xFF;
+		}
+		if (allLow || allHigh)
+			SetSolid(allLow ? LowColor : HighColor);
+	}
+	else {
+		//Same again for each quarter, on its own pixels
+		Split = true;
+		for (int quarter = 0; quarter < QuarterCount; quarter++) {
+			BGRAColor quarterColors[QuarterWidth * QuarterHeight];
+			uint8_t pixelIndices[QuarterWidth * QuarterHeight];
+			int left = (quarter % 2) * QuarterWidth, top = (quarter / 2) * QuarterHeight;
+			for (int y = 0; y < QuarterHeight; y++)
+				for (int x = 0; x < QuarterWidth; x++) {
+					pixelIndices[y * QuarterWidth + x] = (uint8_t)((top + y) * Width + left + x);
+					quarterColors[y * QuarterWidth + x] = colorData[(top + y) * Width + left + x];
+				}
+
+			BGRAColor color1, color2;
+			FindDistinctColors(quarterColors, QuarterWidth * QuarterHeight, &color1, &color2);
+			RGB565Color low = EncodeColor(color1, colors), high = EncodeColor(color2, colors);
+			if (quarter == 0) {
+				LowColor = low;
+				HighColor = high;
+			}
+			else {
+				QuarterColors[(quarter - 1) * 2] = low;
+				QuarterColors[(quarter - 1) * 2 + 1] = high;
+			}
+			totalError += ComputePixelBlending(quarterColors, QuarterWidth * QuarterHeight, pixelIndices, ToBGRA(low), ToBGRA(high));
+		}
+	}
+	if (error != nullptr)
+		*error = totalError;
 }
 
 
@@ -1,15 +1,33 @@
 #pragma once
 #include <stdint.h>
 #include "BGRColor.h"
+#include "BGRAColor.h"
 #include "RGB565Color.h"
+#include "YCoCgColor.h"
 #include <cmath>
+#include "..\Kernels\Kernels.h"
 
 class Block
 {
 private:
-	void FindDistinctColors(BGRColor* colorData, BGRColor* color1, BGRColor* color2);
-	void ComputePixelBlending(BGRColor* colorData, BGRColor color1, BGRColor color2);
+	void FindDistinctColors(BGRAColor* colorData, int count, BGRAColor* color1, BGRAColor* color2);
+	//Picks the blend of each color. The pixel indices give where each color is in the block (null if the colors are
+	//the whole block, in order). Returns how far the blends are from the colors, in total.
+	int ComputePixelBlending(BGRAColor* colorData, int count, const uint8_t* pixelIndices, BGRAColor color1, BGRAColor color2);
+	//The 32 bit value of one of the block's colors, to blend the pixels between
+	inline BGRAColor ToBGRA(RGB565Color color) {
+		BGRColor value = DecodeColor(color, Colors);
+		return BGRAColor(value.R(), value.G(), value.B());
+	}
 public:
+	//The format a block's colors are stored in. Either way they're 16 bits, kept in the RGB565Color fields as they're
+	//serialized.
+	enum ColorFormat {
+		COLORS_RGB565,
+		//YCoCgColor: finer luma, and similarity weighs luma and chroma separately (see DifferenceFactor())
+		COLORS_YCOCG
+	};
+
 	//Represents the blending between the two colors in the block
 	enum PixelBlendFactor {
 		//100% color 1
@@ -31,7 +49,14 @@ public:
 		PixelDataLengthBits = RowSizeBits * Height,
 		PixelDataLengthBytes = PixelDataLengthBits / 8,
 		SizeBits = (Width * Height * 2) + (RGB565Color::ColorDepthBits * 2), // W*H*2bpp + 2*colors
-		SizeBytes = SizeBits / 8;
+		SizeBytes = SizeBits / 8,
+		//A split block has 4x4 pixel quarters, each with its own two colors (same blend factor layout)
+		QuarterWidth = Width / 2,
+		QuarterHeight = Height / 2,
+		QuarterCount = 4,
+		SplitSizeBytes = SizeBytes + (QuarterCount - 1) * 2 * (RGB565Color::ColorDepthBits / 8),
+		//A solid block is just its color
+		SolidSizeBytes = RGB565Color::ColorDepthBits / 8;
 
 	//The two colors to blend between
 	RGB565Color LowColor, HighColor;
@@ -39,7 +64,14 @@ public:
 	//The raw pixel data -- initialized as zeroes
 	uint8_t PixelData[PixelDataLengthBytes] = {};
 
-	Block(BGRColor* colorData);
+	//The low and high colors of quarters 1-3 of a split block. Quarter 0 uses LowColor and HighColor.
+	RGB565Color QuarterColors[(QuarterCount - 1) * 2];
+
+	//Builds a block from 8x8 pixels in row order
+	Block(BGRAColor* colorData, ColorFormat colors = COLORS_RGB565);
+	//Builds a block, optionally split into quarters, and gets how far it is from the pixels in total (summed over
+	//every channel of every pixel)
+	Block(BGRAColor* colorData, bool split, int* error, ColorFormat colors = COLORS_RGB565);
 	Block() {}
 	~Block();
 
@@ -47,9 +79,63 @@ public:
 private:
 	//For behind the scenes comparison: it gets the total RGB value of all 16 pixels
 	int PixelValues = 0;
+	//YCoCg blocks only: the totals of 4Y, 2Co and 4Cg of all the pixels, in YCoCgColor's integer units
+	int YCoCgValues[3] = {};
 public:
+	//Whether each quarter of the block has its own colors (adaptive frames only)
+	bool Split = false;
+	//The format LowColor, HighColor and QuarterColors are in
+	ColorFormat Colors = COLORS_RGB565;
+
+	//How much DifferenceFactor() weighs luma and chroma in YCoCg blocks, over 1 << WeightShift. A change in brightness
+	//counts for half what it does in RGB blocks, so lighting noise is let through, while a change in hue (which the
+	//RGB totals don't see at all) counts for a little more than a change in brightness does in RGB blocks.
+	static const int
+		LumaWeight = 3,
+		ChromaWeight = 6,
+		WeightShift = 3;
+
+	//Stores a color in a format
+	inline static RGB565Color EncodeColor(BGRAColor color, ColorFormat colors) {
+		return colors == COLORS_YCOCG ? RGB565Color::CreateFromBacking(YCoCgColor(color.R(), color.G(), color.B()).Backing()) : color.To565();
+	}
+	//Gets the RGB value of a color stored in a format
+	inline static BGRColor DecodeColor(RGB565Color color, ColorFormat colors) {
+		if (colors == COLORS_YCOCG) {
+			YCoCgColor ycocg = YCoCgColor::CreateFromBacking(color.Backing());
+			return BGRColor(ycocg.R(), ycocg.G(), ycocg.B());
+		}
+		return BGRColor::From565(color);
+	}
+
+	//The quarter of the block a pixel is in: 0 1 on top, 2 3 below
+	inline static int QuarterOf(int x, int y) { return (y / QuarterHeight) * 2 + x / QuarterWidth; }
+	//The colors a quarter of the block blends between (the block's own, if it isn't split)
+	inline RGB565Color QuarterLowColor(int quarter) { return Split && quarter > 0 ? QuarterColors[(quarter - 1) * 2] : LowColor; }
+	inline RGB565Color QuarterHighColor(int quarter) { return Split && quarter > 0 ? QuarterColors[(quarter - 1) * 2 + 1] : HighColor; }
+
+	//Whether the block is one color all over: both colors the same and every blend factor 0. Blocks built from pixels
+	//which come out one color are always put in this form.
+	inline bool IsSolid() {
+		if (Split || LowColor.Backing() != HighColor.Backing())
+			return false;
+		for (int i = 0; i < PixelDataLengthBytes; i++)
+			if (PixelData[i] != 0)
+				return false;
+		return true;
+	}
+	//Makes the block one color all over
+	inline void SetSolid(RGB565Color color) {
+		LowColor = HighColor = color;
+		for (int i = 0; i < PixelDataLengthBytes; i++)
+			PixelData[i] = 0;
+		Split = false;
+	}
+
 	//Returns the added-together values of the R,G, and B values of all 16 pixels. Used for internal comparisons.
 	inline int GetTotalPixelValue() { return PixelValues; }
+	//Returns the total 4Y (0), 2Co (1) or 4Cg (2) of the pixels of a YCoCg block
+	inline int GetTotalYCoCgValue(int component) { return YCoCgValues[component]; }
 
 	//Gets the blend factor for a specific pixel in the block
 	inline PixelBlendFactor GetBlendFactor(int x, int y) {
@@ -62,16 +148,16 @@ public:
 		return (PixelBlendFactor)byte;
 	}
 
-	//Decodes a pixel's data.
+	//Decodes a pixel's data, the same as the decoder does
 	inline BGRColor Decode(int x, int y) {
 		//Get the 4 possible RGB blends
-		RGB565Color blends[4];
-		blends[0] = LowColor;
-		blends[3] = HighColor;
-		blends[1] = RGB565Color::Blend(blends[0], blends[3], 0.33f);
-		blends[2] = RGB565Color::Blend(blends[0], blends[3], 0.66f);
+		BGRColor blends[4];
+		blends[0] = DecodeColor(QuarterLowColor(QuarterOf(x, y)), Colors);
+		blends[3] = DecodeColor(QuarterHighColor(QuarterOf(x, y)), Colors);
+		blends[1] = BGRColor::Blend(blends[0], blends[3], 0.33f);
+		blends[2] = BGRColor::Blend(blends[0], blends[3], 0.66f);
 
-		return BGRColor::From565(blends[(int)GetBlendFactor(x, y)]);
+		return blends[(int)GetBlendFactor(x, y)];
 	}
 
 	//Compares 2 blocks and returns whether they fall within the similarity threshold.
@@ -84,18 +170,27 @@ public:
 		auto factor = DifferenceFactor(me, other);
 
 		if (factor > similarityThresholdTotal) return false;
+		//The factors of split blocks blend between other colors
+		if (me.Split || other.Split) return false;
 
-		int diff = 0;
-		for (int y = 0; y < Block::Height; y++)
-			for (int x = 0; x < Block::Width; x++) {
-				diff += abs(me.GetBlendFactor(x, y) - other.GetBlendFactor(x, y));
-			}
-
-		return diff < similarityThresholdPixel;
+		return IndexDifference(me, other) < similarityThresholdPixel;
+	}
+	//Gets the sum of the absolute differences between the blend factors of the two blocks' pixels
+	inline static int IndexDifference(const Block& me, const Block& other) {
+		static_assert(PixelDataLengthBytes == 16, "The kernels compare 16 bytes of pixel data");
+		return Kernels::Active().IndexDifference(me.PixelData, other.PixelData);
 	}
-	//Gets the difference factor between the two blocks
+	//Gets the difference factor between the two blocks: how far apart their RGB totals are, or for two YCoCg blocks,
+	//their luma and chroma totals weighed separately
 	inline static int DifferenceFactor(Block& me, Block& other) {
-		return abs(other.PixelValues - me.PixelValues);
+		if (me.Colors != COLORS_YCOCG || other.Colors != COLORS_YCOCG)
+			return abs(other.PixelValues - me.PixelValues);
+		return WeighDifference(abs(other.YCoCgValues[0] - me.YCoCgValues[0]), abs(other.YCoCgValues[1] - me.YCoCgValues[1]), abs(other.YCoCgValues[2] - me.YCoCgValues[2]));
+	}
+	//Weighs how far apart the 4Y, 2Co and 4Cg totals of YCoCg pixels are
+	inline static int WeighDifference(int luma, int co, int cg) {
+		//Doubled, 2Co is in quarters like 4Cg
+		return (luma * LumaWeight + (co * 2 + cg) * ChromaWeight) >> WeightShift;
 	}
 };
 
@@ -1,121 +1,170 @@
 #include "CompressedImage.h"
 #include "ImageDiff.h"
+#include <cassert>
 
-ThreadPool* CompressedImage::_Pool = nullptr;
+Scheduler* CompressedImage::_Pool = nullptr;
 
-CompressedImage::CompressedImage(int width, int height) : _Regions(width / Region::Width, height / Region::Height)
+CompressedImage::CompressedImage(int width, int height) : _Regions((width + Region::Width - 1) / Region::Width, (height + Region::Height - 1) / Region::Height)
 {
+	//The flags in the serialized size leave 13 bits for the width and 14 for the height
+	assert(width < YCoCgColorsSizeFlag /*Image too wide to serialize*/);
+	assert(height < SolidBlocksSizeFlag /*Image too tall to serialize*/);
 	_InternalWidth = width;
 	_InternalHeight = height;
-	_RegionsWidth = width / Region::Width;
-	_RegionsHeight = height / Region::Height;
+	//Round up so the edges of the image get their own (padded) regions instead of being cut off
+	_RegionsWidth = (width + Region::Width - 1) / Region::Width;
+	_RegionsHeight = (height + Region::Height - 1) / Region::Height;
+	_PixelHashes.resize(_RegionsWidth * _RegionsHeight);
+	_RegionVersions.resize(_RegionsWidth * _RegionsHeight, 0);
 }
 
 CompressedImage::~CompressedImage()
 {
-	delete[] _TemporaryArray;
+}
+
+Scheduler& CompressedImage::Pool()
+{
+	//Instantiate the static thread pool if it's null. Streams can start from any thread, so only do it once.
+	static std::once_flag created;
+	std::call_once(created, [] {
+		unsigned int threads = std::thread::hardware_concurrency();
+		_Pool = new Scheduler(threads > 0 ? threads : 4);
+	});
+	return *_Pool;
 }
 
 void CompressedImage::SetData(BGRColor * colorData)
 {
-	//Initialize our temporary data array if this is the first call
-	if (_TemporaryArray == nullptr)
-		_TemporaryArray = new BGRColor[Width() * Height()];
-	RearrangeRGBData(colorData, _TemporaryArray);
-	BuildRegions(_TemporaryArray);
+	BuildRegions(InputFrame::BGR24(colorData, _InternalWidth));
+}
+
+void CompressedImage::SetData(const InputFrame & frame)
+{
+	BuildRegions(frame);
+}
+
+void CompressedImage::SetRegionRowData(const InputFrame & frame, int regionY, bool pickBlockSizes)
+{
+	//Pick the reader once per row; everything under it is specialized for the format
+	switch (frame.Format) {
+	case InputFrame::FORMAT_BGR24: SetRegionRowData<InputFormats::BGR24>(frame, regionY, pickBlockSizes, nullptr, -1); break;
+	case InputFrame::FORMAT_BGRA32: SetRegionRowData<InputFormats::BGRA32>(frame, regionY, pickBlockSizes, nullptr, -1); break;
+	case InputFrame::FORMAT_YUYV: SetRegionRowData<InputFormats::YUYV>(frame, regionY, pickBlockSizes, nullptr, -1); break;
+	case InputFrame::FORMAT_NV12: SetRegionRowData<InputFormats::NV12>(frame, regionY, pickBlockSizes, nullptr, -1); break;
+	}
+}
+
+int CompressedImage::SetRegionRowData(const InputFrame & frame, int regionY, bool pickBlockSizes, CompressedImage & unchanged, int rebuildColumn)
+{
+	switch (frame.Format) {
+	case InputFrame::FORMAT_BGR24: return SetRegionRowData<InputFormats::BGR24>(frame, regionY, pickBlockSizes, &unchanged, rebuildColumn);
+	case InputFrame::FORMAT_BGRA32: return SetRegionRowData<InputFormats::BGRA32>(frame, regionY, pickBlockSizes, &unchanged, rebuildColumn);
+	case InputFrame::FORMAT_YUYV: return SetRegionRowData<InputFormats::YUYV>(frame, regionY, pickBlockSizes, &unchanged, rebuildColumn);
+	case InputFrame::FORMAT_NV12: return SetRegionRowData<InputFormats::NV12>(frame, regionY, pickBlockSizes, &unchanged, rebuildColumn);
+	}
+	return 0;
+}
+
+void CompressedImage::SetRegionData(const InputFrame & frame, int x, int regionY, bool pickBlockSizes)
+{
+	switch (frame.Format) {
+	case InputFrame::FORMAT_BGR24: SetRegionData<InputFormats::BGR24>(frame, x, regionY, pickBlockSizes); break;
+	case InputFrame::FORMAT_BGRA32: SetRegionData<InputFormats::BGRA32>(frame, x, regionY, pickBlockSizes); break;
+	case InputFrame::FORMAT_YUYV: SetRegionData<InputFormats::YUYV>(frame, x, regionY, pickBlockSizes); break;
+	case InputFrame::FORMAT_NV12: SetRegionData<InputFormats::NV12>(frame, x, regionY, pickBlockSizes); break;
+	}
+}
+
+template<typename TInput> void CompressedImage::SetRegionData(const InputFrame & frame, int x, int regionY, bool pickBlockSizes)
+{
+	alignas(16) BGRAColor blockArranged[Region::BlockCount * Block::PixelCount];
+	RearrangeRGBData<TInput>(frame, blockArranged, x, regionY);
+	PixelHash(x, regionY) = Kernels::Active().HashBytes((const uint8_t*)blockArranged, sizeof(blockArranged));
+	ReplaceRegion(x, regionY).Build(blockArranged, true, _Adaptive && pickBlockSizes, BlockColors());
 }
 
-void CompressedImage::RearrangeRGBData(BGRColor * input, BGRColor * output)
+template<typename TInput> int CompressedImage::SetRegionRowData(const InputFrame & frame, int regionY, bool pickBlockSizes, CompressedImage* unchanged, int rebuildColumn)
 {
-	BGRColor* inputCopy = input;
-	int i = 0;
-	for (int y = 0; y < _InternalHeight; y++)
-		for (int x = 0; x < _InternalWidth; x++) {
-			inputCopy[y*_InternalWidth + x] = inputCopy[i];
-			i++;
+	static_assert(sizeof(BGRAColor) * Block::PixelCount % Kernels::HashStripeBytes == 0, "Regions are hashed in whole stripes");
+	const Kernels::KernelTable& kernels = Kernels::Active();
+	//Rearrange one region at a time into a small local buffer -- it stays in L1/L2 while the blocks are built from it.
+	//It's hashed there too, whatever the input format.
+	alignas(16) BGRAColor blockArranged[Region::BlockCount * Block::PixelCount];
+	int copied = 0;
+	//The regions which were built, which still need their blocks matched up: runs of them are matched in one go
+	std::vector<Region*> run;
+	run.reserve(RegionsWide());
+	for (int x = 0; x < RegionsWide(); x++) {
+		RearrangeRGBData<TInput>(frame, blockArranged, x, regionY);
+		uint64_t hash = kernels.HashBytes((const uint8_t*)blockArranged, sizeof(blockArranged));
+		PixelHash(x, regionY) = hash;
+		if (unchanged != nullptr && x != rebuildColumn && unchanged->PixelHash(x, regionY) == hash) {
+			ShareRegion(x, regionY, *unchanged);
+			copied++;
+			if (!run.empty())
+				Region::MatchSimilarBlocks(run.data(), (int)run.size());
+			run.clear();
+			continue;
 		}
+		//Built where it's kept, rather than copied there
+		Region& region = ReplaceRegion(x, regionY);
+		region.Build(blockArranged, false, _Adaptive && pickBlockSizes, BlockColors());
+		run.push_back(&region);
+	}
+	if (!run.empty())
+		Region::MatchSimilarBlocks(run.data(), (int)run.size());
+	return copied;
+}
 
+template<typename TInput> void CompressedImage::RearrangeRGBData(const InputFrame & input, BGRAColor * output, int regionX, int regionY)
+{
 	//We need to re-order the data into a chunk format.
 
 	//We need to reorder the data from:
 	//(0,0) (1,0)...(99,0) (0,1)...(99,99) to
-	//4x4 pixel grids stored in 32 by 32 segments, all row order
+	//8x8 pixel grids stored in 32 by 32 segments, all row order
 
 	//The code's a bit hard to follow, so at a high level, what it does is:
-	//The outer 2 loops go over regions of the image in row order
-	//Then the next 2 loops go over each block in each region, again in row order
+	//The outer 2 loops go over each block in the region, in row order
 	//In that loop, we compute the pixel position of the top left of the block
 	//Then, the next loop goes over each row of the block, again in row order
 	//Here, we compute the memory offset of the top left of the row.
-	//Then, the final loop actually copies the RGB data (the optimizer should do its job here)
-
-	//Despite...well...6 nested for loops, the actual algorithm is O(N), I swear
-
-	//The for loop hell is real
-	for (int regionY = 0; regionY < RegionsTall(); regionY++) {
-		for (int regionX = 0; regionX < RegionsWide(); regionX++)
-			for (int blockY = 0; blockY < Region::BlocksPerColumn; blockY++)
-				for (int blockX = 0; blockX < Region::BlocksPerRow; blockX++)
-				{
-					/*
-					int blockT = blockY * Block::Height + regionY * Region::Height;
-					int blockL = blockX * Block::Width + regionX * Region::Width;
-
-					for (int pixelY = 0; pixelY < Block::Height; pixelY++) {
-						for (int pixelX = 0; pixelX < Block::Width; pixelX++) {
-							arr->set((pixelX + blockL), (pixelY + blockT), inputCopy[(pixelY + blockT)*_InternalWidth + pixelX + blockL]);
-						}
-					}
-					*/
-					int pixelX = regionX * Region::Width + blockX * Block::Width;
-					int pixelY = regionY * Region::Height + blockY * Block::Height;
-					for (int row = 0; row < Block::Height; row++) {
-						uint8_t* inp = (uint8_t*)&input[(pixelY + row) * _InternalWidth + pixelX];
-						//Original code:
-						//Update: the optimizer sucks :(
-						for (int offset = 0; offset < Block::Width * 3; offset++) {
-							*(uint8_t*)output = *inp++; //Let us be silent in prayer the optimizer unrolls this into a single movqd
-							output = (BGRColor*)(((uint8_t*)output) + 1); //And increment the pointer
-						}
-
-						//Optimized code:
-						//static_assert(Block::Width == 4 && Block::Height == 4, "Optimized copy is only on 4x4 blocks");
-						//Optimized to 2 copies instead of 12 byte copies (4 * 3 bytes)
-						// 1 8-byte copy and 1 4-byte copy
-						  //*((uint64_t*)output) = *((uint64_t*)inp); //Turn into a 64 bit copy (instead of 24 bit)
-						  //inp += 8; //And increment
-						  //output = (RGBColor*)(((uint8_t*)output) + 8); //...the pointers
-
-						  //*((uint32_t*)output) = *((uint32_t*)inp);
-						  //output = (RGBColor*)(((uint8_t*)output) + 4); //increment output pointer
-					}
+	//Then, the input format's reader actually converts and moves the pixel data
+
+	for (int blockY = 0; blockY < Region::BlocksPerColumn; blockY++)
+		for (int blockX = 0; blockX < Region::BlocksPerRow; blockX++)
+		{
+			int pixelX = regionX * Region::Width + blockX * Block::Width;
+			int pixelY = regionY * Region::Height + blockY * Block::Height;
+			for (int row = 0; row < Block::Height; row++) {
+				//Edge regions hang off the bottom of the image: repeat the last row
+				int sourceY = pixelY + row < _InternalHeight ? pixelY + row : _InternalHeight - 1;
+
+				if (pixelX + Block::Width <= _InternalWidth) {
+					//Fast path: the whole block row is inside the image
+					TInput::ReadPixels(input, pixelX, sourceY, Block::Width, output);
 				}
-	}
-
+				else {
+					//And for edge regions hanging off the right, repeat the last column
+					for (int x = 0; x < Block::Width; x++)
+						TInput::ReadPixels(input, pixelX + x < _InternalWidth ? pixelX + x : _InternalWidth - 1, sourceY, 1, output + x);
+				}
+				output += Block::Width;
+			}
+		}
 }
 
-void CompressedImage::BuildRegions(BGRColor* blockArranged) {
-	//Instantiate the static thread pool if it's null
-	if (_Pool == nullptr)
-		_Pool = new ThreadPool(4);
+void CompressedImage::BuildRegions(const InputFrame& input) {
 	//Concurrent version of:
 	//for (int y = 0; y < RegionsTall(); y++)
 	// for (int x = 0; x < RegionsWide(); x++)
-	//  image.GetRegion(x, y) = Region(&blockArranged[(y * RegionsWide() * bytesPerRegion) + x * bytesPerRegion]);
+	//  image.GetRegion(x, y) = Region(RearrangeRGBData(input, x, y));
 
-	int bytesPerRegion = Region::BlockCount * Block::PixelCount;
+	//Each task owns one row of regions from the source image all the way to the built regions, so there's
+	//no serial pass over the frame and the work scales with the number of cores
 	std::vector<std::future<void>> futures;
-	for (int y = 0; y < RegionsTall(); y++) {
-		futures.push_back(
-			_Pool->enqueue(
-				[](int y, CompressedImage* image, BGRColor* blockArrangedColors, int bytesPerReg) {
-			for (int x = 0; x < image->RegionsWide(); x++) {
-				image->GetRegion(x, y) = Region(&blockArrangedColors[(y * image->RegionsWide() * bytesPerReg) + x * bytesPerReg]);
-				//And increment for the next block
-				//blockArranged += Region::BlockCount * Block::PixelCount;
-			}
-		}, y, this, blockArranged, bytesPerRegion));
-	}
+	for (int y = 0; y < RegionsTall(); y++)
+		futures.push_back(Pool().Enqueue([this, &input, y] { SetRegionRowData(input, y); }));
 
 	//And wait for all the enqueued objects
 	for (size_t i = 0; i < futures.size(); i++)
@@ -134,17 +183,14 @@ void CompressedImage::GetStatistics(int* sizeBytes, int* sizeBytesWithoutDedupli
 
 	for (int regionY = 0; regionY < RegionsTall(); regionY++) {
 		for (int regionX = 0; regionX < RegionsWide(); regionX++) {
-			//Add the region overhead
-			*sizeBytes += Region::BlockTableSizeBytes;
 			//Iterate over the region
 			Region& region = GetRegion(regionX, regionY);
+			*sizeBytes += region.EncodedSizeBytes(_Adaptive, _TemporalBlocks, _SolidBlocks);
 			for (int blockY = 0; blockY < Region::BlocksPerColumn; blockY++) {
 				for (int blockX = 0; blockX < Region::BlocksPerRow; blockX++)
 				{
-					//And, for each block, add its size if it's not deduplicated
-					if (region.IsBlockPresent(blockX, blockY))
-						*sizeBytes += Block::SizeBytes;
-					else
+					//And, for each block, count it if it's deduplicated
+					if (!region.IsBlockPresent(blockX, blockY))
 						*deduplicatedBlockCount += 1;
 				}
 			}
@@ -168,21 +214,18 @@ void CompressedImage::GetStatistics(ImageDiff & differences, int * sizeBytes, in
 		for (int regionX = 0; regionX < RegionsWide(); regionX++) {
 			//Iterate over the region
 			Region& region = GetRegion(regionX, regionY);
-			//Check if the two regions are similar enough
-			if (differences.AreSimilar(regionX, regionY)) {
+			//Check if the two regions are similar enough (or the region is copied from another reference)
+			if (!differences.IsPresent(regionX, regionY)) {
 				*deduplicatedRegionCount += 1;
 				continue;
 			}
-			//Add the region overhead
-			*sizeBytes += Region::BlockTableSizeBytes;
+			*sizeBytes += region.EncodedSizeBytes(_Adaptive, _TemporalBlocks, _SolidBlocks);
 			//And iterate over the blocks if the regions are not identical
 			for (int blockY = 0; blockY < Region::BlocksPerColumn; blockY++) {
 				for (int blockX = 0; blockX < Region::BlocksPerRow; blockX++)
 				{
-					//And, for each block, add its size if it's not deduplicated
-					if (region.IsBlockPresent(blockX, blockY))
-						*sizeBytes += Block::SizeBytes;
-					else
+					//And, for each block, count it if it's deduplicated
+					if (!region.IsBlockPresent(blockX, blockY))
 						*deduplicatedBlockCount += 1;
 				}
 			}
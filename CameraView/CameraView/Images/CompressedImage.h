@@ -1,10 +1,13 @@
 #pragma once
 #include "Region.h"
+#include "RegionHandle.h"
 #include "..\Array2D.h"
 #include "BGRColor.h"
+#include "InputFormats.h"
 #include <stdint.h>
+#include <vector>
 #include "Block.h"
-#include "..\ThreadPool.h"
+#include "..\Scheduler.h"
 
 /*
 * Each image is made up of a series of regions - large blocks of pixel data (32x32 -- 1024 pixels)
@@ -27,8 +30,7 @@
 *      Thus, the region uses the space of up to 66 blocks to represent 64 blocks, but in practice much less as neighboring blocks
 *      can be highly similar (e.g. in a flat color image, a region is represented by only 3 blocks of data)
 *
-* Each of those blocks are made up of 2 color samples stored in 8-4-4 format:
-*      8 bit Y (luminosity), 4 bit U and 4 bit V (chroma).
+* Each of those blocks are made up of 2 color samples stored in 16 bit RGB 565 format (or YCoCg, see below),
 *      and 2 bits per pixel: 0-3 describe how to blend between color 1 and color 2:
 *          0 = 100% color 1
 *          1 = 66% color 1, 33% color 2
@@ -49,11 +51,37 @@
 *      192 bits - 4224 bits per region
 *
 * The image is then structured as such:
-*	2 bytes Width
-*	2 bytes Height
-*   [Width * Height] bit region table. Any region marked as a "1" is present. Any region marked as a zero is not
+*	2 bytes Width (big endian, in pixels)
+*	2 bytes Height (big endian, in pixels)
+*   [RegionsWide * RegionsTall] bit region table. Any region marked as a "1" is present. Any region marked as a zero is not
 *		encoded in the current image and should be copied from the previous frame (the two are identical)
 *   Then, the raw regions are written into the stream, in top-left to bottom-right order.
+*
+* Images whose size is not a multiple of the region size are padded up to the next region: the edge regions
+* are filled by repeating the last column/row of the source image, and the decoder crops them back off.
+*
+* Adaptive images set the top bit of the width (AdaptiveSizeFlag). Each of their regions starts with a mode byte:
+*	0 (blocks): the block table, then a 16 bit split mask (big endian, bit N set if block N is split), then the present
+*		blocks. A split block has a color pair per 4x4 quarter: both colors of quarter 0, then 1, 2 and 3, then the
+*		blend factors as usual -- 32 bytes.
+*	1 (whole): a single block whose 8x8 pixels each cover a 4x4 cell of the region -- 20 bytes.
+*
+* Images with block level temporal skipping set the top bit of the height (TemporalBlocksSizeFlag). Their block mode
+* regions have a 16 bit temporal mask (big endian) after the block table: bit N set if block N is unchanged from the
+* previous frame's block in the same place. Those blocks aren't in the stream, and neighbors which are represented by
+* them get the previous frame's block too.
+*
+* Images which use long-term references (see ReferenceSet) set the second bit of the width (ReferencesSizeFlag). Their
+* region table is followed by a reference table of the same size: bit N set if region N is copied from a reference
+* instead. Then comes a byte per set bit, in order: the number of the reference the region is copied from.
+*
+* Images with solid blocks set the second bit of the height (SolidBlocksSizeFlag). Their block mode regions have a 16
+* bit solid mask (big endian) after the split mask, or where it would be: bit N set if block N is one color all over.
+* Those blocks are written as just the color -- 2 bytes.
+*
+* Images with YCoCg colors set the third bit of the width (YCoCgColorsSizeFlag). Every color in their blocks is a
+* YCoCgColor -- 6 bit luma, 5 bits each of Co and Cg, in the same 2 bytes -- instead of RGB 565. Blocks kept from earlier
+* frames (unchanged, or copied from a reference) stay in the format they were sent in.
 */
 
 class ImageDiff;
@@ -63,30 +91,93 @@ class CompressedImage
 {
 private:
 	//Threadpool for processing
-	static ThreadPool* _Pool;
+	static Scheduler* _Pool;
 	//The size of the input data to the image. Ergo, the original size
 	int _InternalWidth;
 	int _InternalHeight;
-	//The number of regions wide and tall the image is. The actual encoded size
+	//The number of regions wide and tall the image is (rounded up). The actual encoded size
 	int _RegionsWidth;
 	int _RegionsHeight;
-	//A temporary array initialized on the first SetData() call
-	BGRColor* _TemporaryArray = nullptr;
-	Array2D<Region> _Regions;
+	//Shared with the other images which have the same regions (see RegionHandle)
+	Array2D<RegionHandle> _Regions;
+	//A hash of the source pixels each region was last set from
+	std::vector<uint64_t> _PixelHashes;
+	//How many times the decoder replaced each region
+	std::vector<uint32_t> _RegionVersions;
+	bool _Adaptive = false;
+	bool _TemporalBlocks = false;
+	bool _References = false;
+	bool _SolidBlocks = false;
+	bool _YCoCgColors = false;
 public:
+	//Set in the serialized width of adaptive images. Widths are limited to 8191 pixels and heights to 16383.
+	static const int AdaptiveSizeFlag = 0x8000;
+	//Set in the serialized width of images which copy regions from long-term references
+	static const int ReferencesSizeFlag = 0x4000;
+	//Set in the serialized width of images whose blocks' colors are YCoCg
+	static const int YCoCgColorsSizeFlag = 0x2000;
+	//Set in the serialized height of images with block level temporal skipping
+	static const int TemporalBlocksSizeFlag = 0x8000;
+	//Set in the serialized height of images which code solid blocks in just their color
+	static const int SolidBlocksSizeFlag = 0x4000;
 
 	inline int Width() { return _RegionsWidth * Region::Width; }
 	inline int Height() { return _RegionsHeight * Region::Height; }
+	//The size of the source image, before it was padded out to the region bounds
+	inline int SourceWidth() { return _InternalWidth; }
+	inline int SourceHeight() { return _InternalHeight; }
 	inline int RegionsWide() { return _RegionsWidth; }
 	inline int RegionsTall() { return _RegionsHeight; }
 
-	inline Region& GetRegion(int x, int y) { return _Regions.Get(x, y); }
+	//Gets a region for reading. Regions may be shared with other images, so they're changed through EditRegion().
+	inline Region& GetRegion(int x, int y) { return _Regions.Get(x, y).Get(); }
+	//Gets a region for changing, copying it first if another image shares it
+	inline Region& EditRegion(int x, int y) { return _Regions.Get(x, y).Edit(); }
+	//Gets a region for setting from scratch: its contents are undefined, but it's the image's own
+	inline Region& ReplaceRegion(int x, int y) { return _Regions.Get(x, y).Replace(); }
+	//Makes a region the same as the one in the same place of another image of the same size, by sharing it
+	inline void ShareRegion(int x, int y, CompressedImage& from) { _Regions.Get(x, y) = from._Regions.Get(x, y); }
+	inline RegionHandle& GetRegionHandle(int x, int y) { return _Regions.Get(x, y); }
+	//The hash of the source pixels a region was last set from (whatever it was replaced with since)
+	inline uint64_t& PixelHash(int x, int y) { return _PixelHashes[y * _RegionsWidth + x]; }
+	//Goes up every time the decoder replaces the region (sent, or copied from a reference), so a surface which is kept
+	//from frame to frame can tell which of its regions are out of date (see Decoder::DecodeChangedRegions())
+	inline uint32_t& RegionVersion(int x, int y) { return _RegionVersions[y * _RegionsWidth + x]; }
+
+	//Whether the regions pick their block sizes to suit the content (see Region::RegionMode). Takes effect from the
+	//next time the image's data is set.
+	inline bool& Adaptive() { return _Adaptive; }
+	//Whether the regions' temporal masks are used, i.e. unchanged blocks of changed regions are left out
+	inline bool& TemporalBlocks() { return _TemporalBlocks; }
+	//Whether the image has a reference table, i.e. regions can be copied from long-term references
+	inline bool& References() { return _References; }
+	//Whether the regions have solid masks, i.e. blocks of one color are coded in just that color
+	inline bool& SolidBlocks() { return _SolidBlocks; }
+	//Whether the blocks' colors are stored as YCoCg instead of RGB 565. Takes effect from the next time the image's data
+	//is set.
+	inline bool& YCoCgColors() { return _YCoCgColors; }
+	inline Block::ColorFormat BlockColors() { return _YCoCgColors ? Block::COLORS_YCOCG : Block::COLORS_RGB565; }
+
+	//The thread pool shared by all images for encoding and decoding work. Sized to the machine's core count.
+	static Scheduler& Pool();
 
 	CompressedImage(int width, int height);
 	~CompressedImage();
 
 	//Sets the image's data from a row-ordered RGB array
 	void SetData(BGRColor* colorData);
+	//Sets the image's data from a frame in any of the supported input formats
+	void SetData(const InputFrame& frame);
+	//Sets a single row of regions from a frame of the whole image. Rows are independent of each other, so they can be
+	//set from any thread in any order. Adaptive images can skip picking the block sizes, which is quicker but larger.
+	void SetRegionRowData(const InputFrame& frame, int regionY, bool pickBlockSizes = true);
+	//Sets a row of regions, but copies the ones whose source pixels are exactly the same as those of the same region of
+	//another image (the previous frame's) from it instead of building them -- which is most of a fixed camera's or a
+	//screen's. The region in rebuildColumn (-1 for none) is always built. Returns how many were copied.
+	int SetRegionRowData(const InputFrame& frame, int regionY, bool pickBlockSizes, CompressedImage& unchanged, int rebuildColumn);
+	//Sets a single region from a frame of the whole image, e.g. one which has to be resent from a row which otherwise
+	//isn't
+	void SetRegionData(const InputFrame& frame, int x, int regionY, bool pickBlockSizes);
 
 	//Computes some useful statistics on the image. Expensive! Iterates over the entire image.
 	void GetStatistics(int* sizeBytes, int* sizeBytesWithoutDeduplication, int* deduplicatedBlockCount, int* totalBlockCount);
@@ -95,9 +186,11 @@ public:
 	void GetStatistics(ImageDiff & differences, int * sizeBytes, int * sizeBytesWithoutDeduplication, int * deduplicatedBlockCount, int * totalBlockCount, int* deduplicatedRegionCount, int* totalRegionCount);
 
 private:
-	//Reorders the pixel data from openCV into a series of "chunks" in memory
-	void RearrangeRGBData(BGRColor* input, BGRColor* output);
-	//Builds the region objects in the array
-	void BuildRegions(BGRColor* blockArranged);
+	//Reorders one region of the input frame into a series of "chunks" in memory, converting it to 32 bit color as it goes
+	template<typename TInput> void RearrangeRGBData(const InputFrame& input, BGRAColor* output, int regionX, int regionY);
+	template<typename TInput> int SetRegionRowData(const InputFrame& frame, int regionY, bool pickBlockSizes, CompressedImage* unchanged, int rebuildColumn);
+	template<typename TInput> void SetRegionData(const InputFrame& frame, int x, int regionY, bool pickBlockSizes);
+	//Rearranges and builds the region objects in the array, one task per row of regions
+	void BuildRegions(const InputFrame& input);
 };
 
@@ -1,4 +1,5 @@
 #include "Decoder.h"
+#include <cstring>
 
 
 
@@ -13,110 +14,681 @@ Decoder::~Decoder()
 
 void Decoder::DecodeImageToBGRArray(CompressedImage & image, BGRColor * arr, int arrWidth, int arrHeight)
 {
-	//Make sure the RGB array is big enough
-	assert(arrWidth >= image.Width());
-	assert(arrHeight >= image.Height());
+	DecodeImage(image, OutputSurface::BGR24(arr, arrWidth, arrHeight));
+}
+
+void Decoder::DecodeImage(CompressedImage & image, const OutputSurface & surface)
+{
+	//Each tile writes to its own part of the surface, so they can be decoded concurrently
+	int tileRegions = TileRegionsWide(image, surface);
+	std::vector<std::future<void>> futures;
+	for (int regionY = 0; regionY < image.RegionsTall(); regionY++)
+		for (int regionX = 0; regionX < image.RegionsWide(); regionX += tileRegions) {
+			int regionCount = image.RegionsWide() - regionX < tileRegions ? image.RegionsWide() - regionX : tileRegions;
+			futures.push_back(CompressedImage::Pool().Enqueue([&image, &surface, regionX, regionY, regionCount] { DecodeTile(image, regionX, regionY, regionCount, surface); }));
+		}
+
+	for (size_t i = 0; i < futures.size(); i++)
+		futures[i].wait();
+}
+
+int Decoder::DecodeChangedRegions(CompressedImage & image, const OutputSurface & surface, std::vector<uint32_t>& decodedVersions)
+{
+	std::vector<Tile> tiles;
+	FindChangedTiles(image, surface, decodedVersions, tiles);
+
+	int decoded = 0;
+	std::vector<std::future<void>> futures;
+	for (size_t i = 0; i < tiles.size(); i++) {
+		Tile tile = tiles[i];
+		decoded += tile.RegionCount;
+		futures.push_back(CompressedImage::Pool().Enqueue([&image, &surface, tile] { DecodeTile(image, tile.RegionX, tile.RegionY, tile.RegionCount, surface); }));
+	}
 
+	for (size_t i = 0; i < futures.size(); i++)
+		futures[i].wait();
+	return decoded;
+}
+
+void Decoder::FindChangedTiles(CompressedImage & image, const OutputSurface & surface, std::vector<uint32_t>& decodedVersions, std::vector<Tile>& tiles)
+{
+	//A new surface is out of date everywhere
+	int count = image.RegionsWide() * image.RegionsTall();
+	if ((int)decodedVersions.size() != count) {
+		decodedVersions.resize(count);
+		for (int i = 0; i < count; i++)
+			decodedVersions[i] = image.RegionVersion(i % image.RegionsWide(), i / image.RegionsWide()) - 1;
+	}
+
+	//The runs of changed regions are decoded as tiles, no longer than the usual ones
+	int tileRegions = TileRegionsWide(image, surface);
+	tiles.clear();
 	for (int regionY = 0; regionY < image.RegionsTall(); regionY++) {
+		uint32_t* versions = decodedVersions.data() + regionY * image.RegionsWide();
+		for (int regionX = 0; regionX < image.RegionsWide(); regionX++) {
+			if (versions[regionX] == image.RegionVersion(regionX, regionY))
+				continue;
+			int runStart = regionX;
+			while (regionX < image.RegionsWide() && regionX - runStart < tileRegions && versions[regionX] != image.RegionVersion(regionX, regionY)) {
+				versions[regionX] = image.RegionVersion(regionX, regionY);
+				regionX++;
+			}
+			tiles.push_back(Tile{ runStart, regionY, regionX - runStart });
+			//Back onto the region which ended the run
+			regionX--;
+		}
+	}
+}
+
+int Decoder::TileRegionsWide(CompressedImage & image, const OutputSurface & surface)
+{
+	int regions = TileSizeBytes / (Region::Width * Region::Height * surface.BytesPerPixel());
+	if (regions < 1)
+		return 1;
+	return regions < image.RegionsWide() ? regions : image.RegionsWide();
+}
+
+void Decoder::DecodeTile(CompressedImage & image, int regionX, int regionY, int regionCount, const OutputSurface & surface)
+{
+	//Only the source image is written out -- the padding in the edge regions is cropped off
+	int columns = surface.Width < image.SourceWidth() ? surface.Width : image.SourceWidth();
+	int rows = surface.Height < image.SourceHeight() ? surface.Height : image.SourceHeight();
+
+	//Pick the writer once per tile; everything under it is specialized for the format
+	switch (surface.Format) {
+	case OutputSurface::FORMAT_BGR24: DecodeTile<OutputFormats::BGR24>(image, regionX, regionY, regionCount, surface, columns, rows); break;
+	case OutputSurface::FORMAT_BGRA32: DecodeTile<OutputFormats::BGRA32>(image, regionX, regionY, regionCount, surface, columns, rows); break;
+	case OutputSurface::FORMAT_RGB565: DecodeTile<OutputFormats::RGB565>(image, regionX, regionY, regionCount, surface, columns, rows); break;
+	}
+}
+
+//How many blocks back (in row order) the block representing a block is, by its presence status
+static const int RepresentativeOffsets[] = { 0, 1, Region::BlocksPerRow, Region::BlocksPerRow + 1 };
+
+template<typename TOutput> void Decoder::DecodeTile(CompressedImage & image, int firstRegionX, int regionY, int regionCount, const OutputSurface & surface, int columns, int rows)
+{
+	static_assert(Block::RowSizeBytes == 2, "Rows are read 16 bits at a time");
+	const Kernels::KernelTable& kernels = Kernels::Active();
+	for (int blockY = 0; blockY < Region::BlocksPerColumn; blockY++) {
+		int blockTopY = regionY * Region::Height + blockY * Block::Height;
+		if (blockTopY >= rows)
+			return;
+		int blockRows = rows - blockTopY < Block::Height ? rows - blockTopY : Block::Height;
+
+		for (int regionX = firstRegionX; regionX < firstRegionX + regionCount; regionX++) {
+			//Cache the region for perf
+			Region& region = image.GetRegion(regionX, regionY);
+			if (region.Mode == Region::MODE_WHOLE) {
+				DecodeWholeRegionRows<TOutput>(region, regionX * Region::Width, blockY, blockTopY, blockRows, columns, surface);
+				continue;
+			}
+
+			for (int blockX = 0; blockX < Region::BlocksPerRow; blockX++)
+			{
+				int blockTopLeftX = regionX * Region::Width + blockX * Block::Width;
+				//Crop the edge regions
+				int pixelCount = columns - blockTopLeftX < Block::Width ? columns - blockTopLeftX : Block::Width;
+				if (pixelCount <= 0)
+					break;
+				//A block represented by a neighbor is the same as it, and the neighbor has been written out already (it
+				//comes before it in the same region, in row order): copy its pixels, unless it was cropped
+				Region::BlockPresence presence = region.BlockPresenceStatus(blockX, blockY);
+				if (presence != Region::BLOCK_PRESENT) {
+					int source = blockY * Region::BlocksPerRow + blockX - RepresentativeOffsets[presence];
+					int sourceX = regionX * Region::Width + source % Region::BlocksPerRow * Block::Width;
+					int sourceY = regionY * Region::Height + source / Region::BlocksPerRow * Block::Height;
+					if (columns - sourceX >= pixelCount) {
+						int bytesPerPixel = surface.BytesPerPixel();
+						for (int pixelY = 0; pixelY < blockRows; pixelY++)
+							memcpy(surface.Data + (blockTopY + pixelY) * surface.Stride + blockTopLeftX * bytesPerPixel,
+								surface.Data + (sourceY + pixelY) * surface.Stride + sourceX * bytesPerPixel, pixelCount * bytesPerPixel);
+						continue;
+					}
+				}
+				Block& block = region.GetBlock(blockX, blockY);
+				if (block.IsSolid()) {
+					//No blends to work out: fill the rows with the one color
+					typename TOutput::Pixel pixel = TOutput::FromBGR(Block::DecodeColor(block.LowColor, block.Colors));
+					for (int pixelY = 0; pixelY < blockRows; pixelY++)
+						TOutput::Fill(surface.Data + (blockTopY + pixelY) * surface.Stride, blockTopLeftX, pixelCount, pixel);
+					continue;
+				}
+				if (block.Split) {
+					DecodeSplitBlock<TOutput>(block, blockTopLeftX, blockTopY, pixelCount, blockRows, surface);
+					continue;
+				}
+				//Get the block's 4 possible blend colors in the output format
+				typename TOutput::Pixel palette[4];
+				TOutput::BuildPalette(block.LowColor, block.HighColor, block.Colors, palette);
+
+				//Write the block out a row at a time
+				for (int pixelY = 0; pixelY < blockRows; pixelY++) {
+					uint8_t* row = surface.Data + (blockTopY + pixelY) * surface.Stride;
+					//Each row of the block is 16 bits: 2 bits per pixel
+					int rowBits = block.PixelData[pixelY * Block::RowSizeBytes] | (block.PixelData[pixelY * Block::RowSizeBytes + 1] << 8);
+					if (pixelCount == Block::Width)
+						TOutput::WriteRow(kernels, row, blockTopLeftX, palette, rowBits);
+					else
+						for (int pixelX = 0; pixelX < pixelCount; pixelX++)
+							TOutput::Write(row, blockTopLeftX + pixelX, palette[(rowBits >> (pixelX * 2)) & 0b11]);
+				}
+			}
+		}
+	}
+}
+
+template<typename TOutput> void Decoder::DecodeSplitBlock(Block & block, int left, int top, int pixelCount, int pixelRows, const OutputSurface & surface)
+{
+	//A palette per quarter
+	typename TOutput::Pixel palettes[Block::QuarterCount][4];
+	for (int quarter = 0; quarter < Block::QuarterCount; quarter++)
+		TOutput::BuildPalette(block.QuarterLowColor(quarter), block.QuarterHighColor(quarter), block.Colors, palettes[quarter]);
+
+	for (int pixelY = 0; pixelY < pixelRows; pixelY++) {
+		uint8_t* row = surface.Data + (top + pixelY) * surface.Stride;
+		int rowBits = block.PixelData[pixelY * Block::RowSizeBytes] | (block.PixelData[pixelY * Block::RowSizeBytes + 1] << 8);
+		//The left half of the row is in one quarter, the right half in the next
+		typename TOutput::Pixel* leftPalette = palettes[Block::QuarterOf(0, pixelY)];
+		typename TOutput::Pixel* rightPalette = palettes[Block::QuarterOf(Block::QuarterWidth, pixelY)];
+		for (int pixelX = 0; pixelX < pixelCount; pixelX++)
+			TOutput::Write(row, left + pixelX, (pixelX < Block::QuarterWidth ? leftPalette : rightPalette)[(rowBits >> (pixelX * 2)) & 0b11]);
+	}
+}
+
+template<typename TOutput> void Decoder::DecodeWholeRegionRows(Region & region, int left, int blockY, int top, int pixelRows, int columns, const OutputSurface & surface)
+{
+	//Every block is the whole region block
+	Block& block = region.Blocks[0];
+	typename TOutput::Pixel palette[4];
+	TOutput::BuildPalette(block.LowColor, block.HighColor, block.Colors, palette);
+
+	for (int pixelY = 0; pixelY < pixelRows; pixelY++) {
+		uint8_t* row = surface.Data + (top + pixelY) * surface.Stride;
+		//Each pixel of the block's rows is a cell of the region
+		int cellY = (blockY * Block::Height + pixelY) / Region::WholeCellSize;
+		int rowBits = block.PixelData[cellY * Block::RowSizeBytes] | (block.PixelData[cellY * Block::RowSizeBytes + 1] << 8);
+		for (int cellX = 0; cellX < Block::Width; cellX++) {
+			int cellLeft = left + cellX * Region::WholeCellSize;
+			int pixelCount = columns - cellLeft < Region::WholeCellSize ? columns - cellLeft : Region::WholeCellSize;
+			if (pixelCount <= 0)
+				break;
+			typename TOutput::Pixel pixel = palette[(rowBits >> (cellX * 2)) & 0b11];
+			for (int pixelX = 0; pixelX < pixelCount; pixelX++)
+				TOutput::Write(row, cellLeft + pixelX, pixel);
+		}
+	}
+}
+
+void Decoder::DecodeImageScaled(CompressedImage & image, const OutputSurface & surface, int scale)
+{
+	assert(scale == 2 || scale == 4 || scale == 8);
+	//The output is small enough that a row of regions is plenty for a task
+	std::vector<std::future<void>> futures;
+	for (int regionY = 0; regionY < image.RegionsTall(); regionY++)
+		futures.push_back(CompressedImage::Pool().Enqueue([&image, &surface, regionY, scale] { DecodeRegionRowScaled(image, regionY, surface, scale); }));
+
+	for (size_t i = 0; i < futures.size(); i++)
+		futures[i].wait();
+}
+
+void Decoder::DecodeRegionRowScaled(CompressedImage & image, int regionY, const OutputSurface & surface, int scale)
+{
+	int columns = ScaledSize(image.SourceWidth(), scale);
+	int rows = ScaledSize(image.SourceHeight(), scale);
+	columns = surface.Width < columns ? surface.Width : columns;
+	rows = surface.Height < rows ? surface.Height : rows;
+
+	switch (surface.Format) {
+	case OutputSurface::FORMAT_BGR24: DecodeRegionRowScaled<OutputFormats::BGR24>(image, regionY, surface, scale, columns, rows); break;
+	case OutputSurface::FORMAT_BGRA32: DecodeRegionRowScaled<OutputFormats::BGRA32>(image, regionY, surface, scale, columns, rows); break;
+	case OutputSurface::FORMAT_RGB565: DecodeRegionRowScaled<OutputFormats::RGB565>(image, regionY, surface, scale, columns, rows); break;
+	}
+}
+
+//How many of the 4 pixels of a byte of blend factors use each blend, a byte per count
+static const struct BlendCountTable {
+	uint32_t Counts[256];
+	BlendCountTable() {
+		for (int bits = 0; bits < 256; bits++) {
+			Counts[bits] = 0;
+			for (int pixel = 0; pixel < 4; pixel++)
+				Counts[bits] += 1u << (((bits >> (pixel * 2)) & 0b11) * 8);
+		}
+	}
+} BlendCounts;
+
+//Counts how many pixels of a square cell of a block (2, 4 or 8 pixels across, and inside one quarter of a split block)
+//use each blend: a byte per count, blend 0 lowest
+static inline uint32_t CountBlends(Block & block, int left, int top, int size)
+{
+	static_assert(Block::RowSizeBytes == 2 && Block::Width == 8, "Rows are read a byte (4 pixels) at a time");
+	uint32_t counts = 0;
+	if (size == 2) {
+		//Two rows of 2 pixels -- make a byte of the two half bytes
+		int shift = (left % 4) * 2;
+		uint8_t* first = block.PixelData + top * Block::RowSizeBytes + left / 4;
+		counts = BlendCounts.Counts[((first[0] >> shift) & 0x0F) | (((first[Block::RowSizeBytes] >> shift) & 0x0F) << 4)];
+	}
+	else
+		for (int y = top; y < top + size; y++)
+			for (int x = left / 4; x < (left + size) / 4; x++)
+				counts += BlendCounts.Counts[block.PixelData[y * Block::RowSizeBytes + x]];
+	return counts;
+}
+
+template<typename TOutput> void Decoder::DecodeRegionRowScaled(CompressedImage & image, int regionY, const OutputSurface & surface, int scale, int columns, int rows)
+{
+	//How many output pixels a block is across, and a region
+	int blockPixels = Block::Width / scale;
+	int regionPixels = Region::Width / scale;
+	int scaleShift = scale == 2 ? 1 : scale == 4 ? 2 : 3;
+	for (int regionX = 0; regionX < image.RegionsWide(); regionX++) {
+		Region& region = image.GetRegion(regionX, regionY);
+		int regionLeft = regionX * regionPixels, regionTop = regionY * regionPixels;
+		if (region.Mode == Region::MODE_WHOLE) {
+			DecodeWholeRegionScaled<TOutput>(region, regionLeft, regionTop, scale, columns, rows, surface);
+			continue;
+		}
+
 		for (int blockY = 0; blockY < Region::BlocksPerColumn; blockY++) {
-			for (int pixelY = 0; pixelY < Block::Height; pixelY++) {
-				for (int regionX = 0; regionX < image.RegionsWide(); regionX++) {
-					//Cache the region for perf
-					Region& region = image.GetRegion(regionX, regionY);
-
-					for (int blockX = 0; blockX < Region::BlocksPerRow; blockX++)
-					{
-						int blockTopLeftX = regionX * Region::Width + blockX * Block::Width;
-						int blockTopLeftY = regionY * Region::Height + blockY * Block::Height;
-						//Get the block
-						Block& block = region.GetBlock(blockX, blockY);
-						//Get the 4 possible RGB blend colors
-						BGRColor blends[4];
-						blends[0] = BGRColor::From565(block.LowColor);
-						blends[3] = BGRColor::From565(block.HighColor);
-						blends[1] = BGRColor::Blend(blends[0], blends[3], 0.33f);
-						blends[2] = BGRColor::Blend(blends[0], blends[3], 0.66f);
-
-						//Go over all the pixels in the row and write them into the output vector
-						for (int pixelX = 0; pixelX < Block::Width; pixelX++) {
-							*arr++ = blends[(int)block.GetBlendFactor(pixelX, pixelY)];
+			int blockTop = regionTop + blockY * blockPixels;
+			if (blockTop >= rows)
+				break;
+			for (int blockX = 0; blockX < Region::BlocksPerRow; blockX++) {
+				int blockLeft = regionLeft + blockX * blockPixels;
+				if (blockLeft >= columns)
+					break;
+				Block& block = region.GetBlock(blockX, blockY);
+				//The blends the full decoder would write, once per block (or quarter)
+				uint64_t palettes[Block::QuarterCount][4];
+				int quarters = block.Split ? Block::QuarterCount : 1;
+				for (int quarter = 0; quarter < quarters; quarter++)
+					PackBlends(block.QuarterLowColor(quarter), block.QuarterHighColor(quarter), block.Colors, palettes[quarter]);
+
+				for (int y = 0; y < blockPixels && blockTop + y < rows; y++) {
+					uint8_t* row = surface.Data + (blockTop + y) * surface.Stride;
+					for (int x = 0; x < blockPixels && blockLeft + x < columns; x++) {
+						uint64_t sums = 0;
+						if (block.Split && scale > Block::QuarterWidth) {
+							//The whole block is one pixel, but each quarter has its own colors
+							for (int quarter = 0; quarter < Block::QuarterCount; quarter++)
+								sums += SumBlends(CountBlends(block, (quarter % 2) * Block::QuarterWidth, (quarter / 2) * Block::QuarterHeight, Block::QuarterWidth), palettes[quarter]);
 						}
+						else
+							sums = SumBlends(CountBlends(block, x * scale, y * scale, scale), palettes[block.Split ? Block::QuarterOf(x * scale, y * scale) : 0]);
+						TOutput::Write(row, blockLeft + x, TOutput::FromBGR(Average(sums, scaleShift)));
 					}
 				}
-				//Because we might not match up with width (we may downscale to the nearest region bound),
-				//we have to adjust the pointer every row
-				arr += arrWidth - image.Width();
 			}
 		}
 	}
 }
 
+template<typename TOutput> void Decoder::DecodeWholeRegionScaled(Region & region, int left, int top, int scale, int columns, int rows, const OutputSurface & surface)
+{
+	Block& block = region.Blocks[0];
+	BGRColor palette[4];
+	OutputFormats::BlendColors(block.LowColor, block.HighColor, block.Colors, palette);
+	uint64_t packed[4];
+	PackBlends(block.LowColor, block.HighColor, block.Colors, packed);
+	//Each of the block's pixels is a 4x4 cell of the region: at 1/2 and 1/4 an output pixel is inside one of them, at
+	//1/8 it covers 2x2 of them
+	int regionPixels = Region::Width / scale;
+	for (int y = 0; y < regionPixels && top + y < rows; y++) {
+		uint8_t* row = surface.Data + (top + y) * surface.Stride;
+		int cellY = y * scale / Region::WholeCellSize;
+		for (int x = 0; x < regionPixels && left + x < columns; x++) {
+			int cellX = x * scale / Region::WholeCellSize;
+			BGRColor color;
+			if (scale > Region::WholeCellSize) {
+				//Only 1/8 gets here: 2x2 cells
+				color = Average(SumBlends(CountBlends(block, cellX, cellY, 2), packed), 1);
+			}
+			else
+				color = palette[block.GetBlendFactor(cellX, cellY)];
+			TOutput::Write(row, left + x, TOutput::FromBGR(color));
+		}
+	}
+}
+
 BGRColor * Decoder::DecodeImageToBGRArray(CompressedImage & image)
 {
-	BGRColor* out = new BGRColor[image.Width() * image.Height()];
-	DecodeImageToBGRArray(image, out, image.Width(), image.Height());
+	BGRColor* out = new BGRColor[image.SourceWidth() * image.SourceHeight()];
+	DecodeImageToBGRArray(image, out, image.SourceWidth(), image.SourceHeight());
 	return out;
 }
 
+void Decoder::ReadImageSize(uint8_t * serializedData, int * width, int * height)
+{
+	*width = ((serializedData[0] << 8) | serializedData[1]) & ~(CompressedImage::AdaptiveSizeFlag | CompressedImage::ReferencesSizeFlag | CompressedImage::YCoCgColorsSizeFlag);
+	*height = ((serializedData[2] << 8) | serializedData[3]) & ~(CompressedImage::TemporalBlocksSizeFlag | CompressedImage::SolidBlocksSizeFlag);
+}
+
+bool Decoder::IsAdaptive(uint8_t * serializedData)
+{
+	return (((serializedData[0] << 8) | serializedData[1]) & CompressedImage::AdaptiveSizeFlag) != 0;
+}
+
+bool Decoder::HasTemporalBlocks(uint8_t * serializedData)
+{
+	return (((serializedData[2] << 8) | serializedData[3]) & CompressedImage::TemporalBlocksSizeFlag) != 0;
+}
+
+bool Decoder::HasSolidBlocks(uint8_t * serializedData)
+{
+	return (((serializedData[2] << 8) | serializedData[3]) & CompressedImage::SolidBlocksSizeFlag) != 0;
+}
+
+bool Decoder::HasYCoCgColors(uint8_t * serializedData)
+{
+	return (((serializedData[0] << 8) | serializedData[1]) & CompressedImage::YCoCgColorsSizeFlag) != 0;
+}
+
+bool Decoder::HasReferences(uint8_t * serializedData)
+{
+	return (((serializedData[0] << 8) | serializedData[1]) & CompressedImage::ReferencesSizeFlag) != 0;
+}
+
+bool Decoder::IsKeyframe(uint8_t * serializedData)
+{
+	//Keyframes never refer to the previous frame, or the references before it
+	if (HasTemporalBlocks(serializedData) || HasReferences(serializedData))
+		return false;
+
+	int width, height;
+	ReadImageSize(serializedData, &width, &height);
+	int regionCount = ((width + Region::Width - 1) / Region::Width) * ((height + Region::Height - 1) / Region::Height);
+
+	//Check the region table for any region which isn't present
+	uint8_t* regionTable = serializedData + 4;
+	for (int i = 0; i < regionCount; i++)
+		if ((regionTable[i / 8] & (1 << (i % 8))) == 0)
+			return false;
+	return true;
+}
+
 CompressedImage& Decoder::DeserializeImage(uint8_t* serializedData)
 {
-	int regionsWide = serializedData[0];
-	int regionsTall = serializedData[1];
-	auto img = new CompressedImage(regionsWide * Region::Width, regionsTall * Region::Height);
+	int width, height;
+	ReadImageSize(serializedData, &width, &height);
+	auto img = new CompressedImage(width, height);
 
 	DeserializeImage(*img, serializedData);
 
 	return *img;
 }
 
-void Decoder::DeserializeImage(CompressedImage & image, uint8_t* serializedData)
+void Decoder::DeserializeImage(CompressedImage & image, uint8_t* serializedData, ReferenceSet* references)
+{
+	ReadFrameHeader(image, serializedData, references);
+
+	//The region table follows the header
+	uint8_t* regionTable = serializedData + 4;
+	int regionCount = image.RegionsWide() * image.RegionsTall();
+	serializedData = regionTable + (regionCount + 7) / 8;
+	//Then the reference table and the numbers of the references
+	uint8_t* referenceTable = nullptr;
+	uint8_t* referenceNumbers = nullptr;
+	if (image.References()) {
+		referenceTable = serializedData;
+		referenceNumbers = serializedData += (regionCount + 7) / 8;
+		for (int i = 0; i < regionCount; i++)
+			if (referenceTable[i / 8] & (1 << (i % 8)))
+				serializedData++;
+	}
+
+	DeserializeRegions(image, 0, regionCount, regionTable, referenceTable, referenceNumbers, serializedData, references);
+
+	//And that's all she wrote -- it is "decoded" now
+}
+
+void Decoder::ReadFrameHeader(CompressedImage & image, uint8_t * serializedData, ReferenceSet * references)
 {
-	int regionsWide = serializedData[0];
-	int regionsTall = serializedData[1];
+	int width, height;
+	ReadImageSize(serializedData, &width, &height);
 
-	assert(regionsWide == image.RegionsWide() /*Image width wrong*/);
-	assert(regionsTall == image.RegionsTall() /*Image height wrong*/);
+	assert(width == image.SourceWidth() /*Image width wrong*/);
+	assert(height == image.SourceHeight() /*Image height wrong*/);
+	image.Adaptive() = IsAdaptive(serializedData);
+	image.TemporalBlocks() = HasTemporalBlocks(serializedData);
+	image.References() = HasReferences(serializedData);
+	image.SolidBlocks() = HasSolidBlocks(serializedData);
+	image.YCoCgColors() = HasYCoCgColors(serializedData);
+	assert(references != nullptr || !image.References() /*The stream needs long-term references*/);
 
-	//Read the regions
-	for (int y = 0; y < regionsTall; y++) {
-		for (int x = 0; x < regionsWide; x++) {
-			DecodeRegion(&serializedData, image.GetRegion(x, y));
+	//Frames which don't use the references reset them, which the next frame that does catches up on
+	if (references != nullptr) {
+		for (int y = 0; y < image.RegionsTall(); y++) {
+			if (!image.References())
+				references->InvalidateRow(y);
+			else if (!references->RowValid(y))
+				references->ResetRow(image, y);
 		}
 	}
+}
 
-	//And that's all she wrote -- it is "decoded" now
+//A region about to be decoded: it keeps its unchanged blocks with temporal blocks, otherwise it's all replaced
+static inline Region& RegionToDecode(CompressedImage& image, RegionHandle& region)
+{
+	return image.TemporalBlocks() ? region.Edit() : region.Replace();
+}
+
+uint8_t* Decoder::DeserializeRegions(CompressedImage & image, int firstRegion, int regionCount, uint8_t * regionTable, uint8_t * referenceTable, uint8_t * referenceNumbers, uint8_t * regionData, ReferenceSet * references)
+{
+	//Read the regions. Any region not present is left as is (it's the same as the previous frame's)
+	bool updateReferences = references != nullptr && image.References();
+	for (int i = 0; i < regionCount; i++) {
+		int x = (firstRegion + i) % image.RegionsWide(), y = (firstRegion + i) / image.RegionsWide();
+		RegionHandle& region = image.GetRegionHandle(x, y);
+		bool present = (regionTable[i / 8] & (1 << (i % 8))) != 0;
+		bool referenced = referenceTable != nullptr && (referenceTable[i / 8] & (1 << (i % 8))) != 0;
+		if (present || referenced)
+			image.RegionVersion(x, y)++;
+		if (!updateReferences) {
+			if (present)
+				DecodeRegion(&regionData, RegionToDecode(image, region), image.Adaptive(), image.TemporalBlocks(), image.SolidBlocks(), image.BlockColors());
+			continue;
+		}
+
+		//A region whose references are out of step can't copy from them, and isn't worth keeping them up to date. One
+		//copied from them is left as it was, as if it had been lost.
+		if (references->RegionLost(x, y)) {
+			if (present)
+				DecodeRegion(&regionData, RegionToDecode(image, region), image.Adaptive(), image.TemporalBlocks(), image.SolidBlocks(), image.BlockColors());
+			else if (referenced)
+				referenceNumbers++;
+			continue;
+		}
+		//The references have to see the region as it was
+		if (!present && !referenced) {
+			references->Update(x, y, region, region, true);
+			continue;
+		}
+		//Holding on to it means a region which is decoded gets one of its own
+		RegionHandle previous = region;
+		if (present)
+			DecodeRegion(&regionData, RegionToDecode(image, region), image.Adaptive(), image.TemporalBlocks(), image.SolidBlocks(), image.BlockColors());
+		else {
+			//Callers check the numbers against the set first (see PacketDecoder::IsValid()), so this is only a backstop
+			assert(*referenceNumbers < references->Count() /*No such reference*/);
+			region = references->GetRegionHandle(*referenceNumbers++, x, y);
+		}
+		references->Update(x, y, previous, region, false);
+	}
+	return regionData;
+}
+
+int Decoder::RegionSizeBytes(uint8_t * serializedRegion, bool adaptive, bool temporalBlocks, bool solidBlocks)
+{
+	uint8_t* data = serializedRegion;
+	if (adaptive && *data++ == Region::MODE_WHOLE)
+		return 1 + Block::SizeBytes;
+
+	//The block table says which blocks are there...
+	Region r;
+	for (int i = 0; i < Region::BlockTableSizeBytes; i++)
+		r.BlockTable[i] = *data++;
+	if (temporalBlocks) {
+		r.TemporalMask = (uint16_t)((data[0] << 8) | data[1]);
+		data += Region::TemporalMaskSizeBytes;
+	}
+	//...and the split and solid masks how big they are
+	uint16_t splitMask = 0, solidMask = 0;
+	if (adaptive) {
+		splitMask = (uint16_t)((data[0] << 8) | data[1]);
+		data += Region::SplitMaskSizeBytes;
+	}
+	if (solidBlocks) {
+		solidMask = (uint16_t)((data[0] << 8) | data[1]);
+		data += Region::SolidMaskSizeBytes;
+	}
+	int size = (int)(data - serializedRegion);
+	for (int i = 0; i < Region::BlockCount; i++) {
+		int x = i % Region::BlocksPerRow, y = i / Region::BlocksPerRow;
+		if (r.IsBlockPresent(x, y) && !r.IsBlockTemporal(x, y))
+			size += (solidMask & (1 << i)) ? Block::SolidSizeBytes : (splitMask & (1 << i)) ? Block::SplitSizeBytes : Block::SizeBytes;
+	}
+	return size;
+}
+
+int64_t Decoder::SerializedSizeBytes(uint8_t * serializedData, int64_t availableBytes, int referenceCount)
+{
+	if (availableBytes < 4)
+		return -1;
+	int width, height;
+	ReadImageSize(serializedData, &width, &height);
+	int regionCount = ((width + Region::Width - 1) / Region::Width) * ((height + Region::Height - 1) / Region::Height);
+	bool adaptive = IsAdaptive(serializedData), temporalBlocks = HasTemporalBlocks(serializedData), solidBlocks = HasSolidBlocks(serializedData);
+	bool references = HasReferences(serializedData);
+
+	//Count the regions and references in the tables, then walk the regions
+	uint8_t* end = serializedData + availableBytes;
+	uint8_t* regionTable = serializedData + 4;
+	int tableSize = (regionCount + 7) / 8;
+	uint8_t* data = regionTable + tableSize * (references ? 2 : 1);
+	if (data > end)
+		return -1;
+	int presentCount = 0;
+	for (int i = 0; i < regionCount; i++) {
+		if (regionTable[i / 8] & (1 << (i % 8)))
+			presentCount++;
+		else if (references && (regionTable[tableSize + i / 8] & (1 << (i % 8)))) {
+			if (data >= end || *data >= referenceCount)
+				return -1;
+			data++;
+		}
+	}
+	data = CheckRegions(data, end, presentCount, adaptive, temporalBlocks, solidBlocks);
+	return data != nullptr ? data - serializedData : -1;
+}
+
+uint8_t * Decoder::CheckRegions(uint8_t * regionData, uint8_t * end, int regionCount, bool adaptive, bool temporalBlocks, bool solidBlocks)
+{
+	//The start of a region (mode byte and tables) has to be there before its size can be read. Whole regions only need
+	//their mode byte.
+	int regionStartSize = (adaptive ? 1 + Region::SplitMaskSizeBytes : 0) + Region::BlockTableSizeBytes + (temporalBlocks ? Region::TemporalMaskSizeBytes : 0) +
+		(solidBlocks ? Region::SolidMaskSizeBytes : 0);
+	uint8_t* data = regionData;
+	for (int i = 0; i < regionCount; i++) {
+		if (end - data < 1)
+			return nullptr;
+		if (!(adaptive && *data == Region::MODE_WHOLE)) {
+			if (end - data < regionStartSize || !Region::BlockTableValid(data + (adaptive ? 1 : 0)))
+				return nullptr;
+		}
+		data += RegionSizeBytes(data, adaptive, temporalBlocks, solidBlocks);
+		if (data > end)
+			return nullptr;
+	}
+	return data;
 }
 
-void Decoder::DecodeRegion(uint8_t** ptr, Region& r)
+void Decoder::DecodeRegion(uint8_t** ptr, Region& r, bool adaptive, bool temporalBlocks, bool solidBlocks, Block::ColorFormat colors)
 {
 	auto data = *ptr;
 
-	//Read the block table
-	uint8_t blockTable[Region::BlockTableSizeBytes];
+	r.Mode = adaptive ? (Region::RegionMode)*data++ : Region::MODE_BLOCKS;
+	if (r.Mode == Region::MODE_WHOLE) {
+		//The whole region is the one block
+		DecodeBlock(&data, r.Blocks[0], false, colors);
+		for (int i = 1; i < Region::BlockCount; i++)
+			r.Blocks[i] = r.Blocks[0];
+		*ptr = data;
+		return;
+	}
 
+	//Read the block table
 	for (int i = 0; i < Region::BlockTableSizeBytes; i++)
-		blockTable[i] = *data++;
+		r.BlockTable[i] = *data++;
+	//Which blocks are unchanged
+	r.TemporalMask = 0;
+	if (temporalBlocks) {
+		r.TemporalMask = (uint16_t)((data[0] << 8) | data[1]);
+		data += Region::TemporalMaskSizeBytes;
+	}
+	//And which blocks are split, or one color
+	uint16_t splitMask = 0, solidMask = 0;
+	if (adaptive) {
+		splitMask = (uint16_t)((data[0] << 8) | data[1]);
+		data += Region::SplitMaskSizeBytes;
+	}
+	if (solidBlocks) {
+		solidMask = (uint16_t)((data[0] << 8) | data[1]);
+		data += Region::SolidMaskSizeBytes;
+	}
 
 	//Read all the present blocks
 	for (int y = 0; y < Region::BlocksPerColumn; y++) {
 		for (int x = 0; x < Region::BlocksPerRow; x++) {
-			if (r.IsBlockPresent(x, y)) {
-				//Decode the block
-				uint8_t
-					low_high = *data++, low_low = *data++,
-					high_high = *data++, high_low = *data++;
-
-				Block b = Block();
-				//Read the color data
-				b.LowColor = RGB565Color::CreateFromHighLow(low_high, low_low);
-				b.HighColor = RGB565Color::CreateFromHighLow(high_high, high_low);
-				//And the blend factors
-				for (int i = 0; i < Block::PixelDataLengthBytes; i++)
-					b.PixelData[i] = *data++;
+			Block& b = r.GetBlock(x, y);
+			//Unchanged blocks are kept as they are
+			if (r.IsBlockTemporal(x, y))
+				continue;
+			switch (r.BlockPresenceStatus(x, y)) {
+			case Region::BLOCK_PRESENT:
+				if (solidMask & (1 << (y * Region::BlocksPerRow + x))) {
+					b.SetSolid(RGB565Color::CreateFromHighLow(data[0], data[1]));
+					b.Colors = colors;
+					data += Block::SolidSizeBytes;
+				}
+				else
+					DecodeBlock(&data, b, (splitMask & (1 << (y * Region::BlocksPerRow + x))) != 0, colors);
+				break;
+			//Otherwise copy the neighbor that represents the block (it's always been decoded already)
+			case Region::BLOCK_LEFT_REPRESENTS:
+				b = r.GetBlock(x - 1, y);
+				break;
+			case Region::BLOCK_ABOVE_REPRESENTS:
+				b = r.GetBlock(x, y - 1);
+				break;
+			case Region::BLOCK_ABOVE_LEFT_REPRESENTS:
+				b = r.GetBlock(x - 1, y - 1);
+				break;
 			}
 		}
 	}
 
 	//And update the data pointer
 	*ptr = data;
-}
\ No newline at end of file
+}
+
+void Decoder::DecodeBlock(uint8_t ** ptr, Block & b, bool split, Block::ColorFormat colors)
+{
+	auto data = *ptr;
+	b.Colors = colors;
+
+	//Read the color data
+	b.LowColor = RGB565Color::CreateFromHighLow(data[0], data[1]);
+	b.HighColor = RGB565Color::CreateFromHighLow(data[2], data[3]);
+	data += 4;
+	b.Split = split;
+	if (split) {
+		for (int i = 0; i < (Block::QuarterCount - 1) * 2; i++, data += 2)
+			b.QuarterColors[i] = RGB565Color::CreateFromHighLow(data[0], data[1]);
+	}
+	//And the blend factors
+	for (int i = 0; i < Block::PixelDataLengthBytes; i++)
+		b.PixelData[i] = *data++;
+
+	*ptr = data;
+}
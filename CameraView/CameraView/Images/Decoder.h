@@ -1,21 +1,113 @@
 #pragma once
 #include "BGRColor.h"
 #include "CompressedImage.h"
+#include "OutputFormats.h"
+#include "ReferenceSet.h"
 #include <assert.h>
 class Decoder
 {
 private:
 	Decoder();
 	~Decoder();
-	static void DecodeRegion(uint8_t** ptr, Region& r);
+	static void DecodeRegion(uint8_t** ptr, Region& r, bool adaptive, bool temporalBlocks, bool solidBlocks, Block::ColorFormat colors);
+	static void DecodeBlock(uint8_t** ptr, Block& block, bool split, Block::ColorFormat colors);
+	template<typename TOutput> static void DecodeTile(CompressedImage& image, int regionX, int regionY, int regionCount, const OutputSurface& surface, int columns, int rows);
+	//The fast paths for the adaptive block sizes: a block split into quarters, and one block row's worth of a whole region
+	template<typename TOutput> static void DecodeSplitBlock(Block& block, int left, int top, int pixelCount, int pixelRows, const OutputSurface& surface);
+	template<typename TOutput> static void DecodeWholeRegionRows(Region& region, int left, int blockY, int top, int pixelRows, int columns, const OutputSurface& surface);
+	template<typename TOutput> static void DecodeRegionRowScaled(CompressedImage& image, int regionY, const OutputSurface& surface, int scale, int columns, int rows);
+	template<typename TOutput> static void DecodeWholeRegionScaled(Region& region, int left, int top, int scale, int columns, int rows, const OutputSurface& surface);
+	//The blends of a block (or quarter) with R, G and B in 16 bit lanes, so a cell's colors are summed with a
+	//multiply per blend. Even a whole block's sums fit in the lanes.
+	static inline void PackBlends(RGB565Color low, RGB565Color high, Block::ColorFormat colors, uint64_t packed[4]) {
+		BGRColor blends[4];
+		OutputFormats::BlendColors(low, high, colors, blends);
+		for (int i = 0; i < 4; i++)
+			packed[i] = blends[i].R() | ((uint64_t)blends[i].G() << 16) | ((uint64_t)blends[i].B() << 32);
+	}
+	//Sums the colors of a cell, from its blend counts
+	static inline uint64_t SumBlends(uint32_t counts, const uint64_t packed[4]) {
+		return (counts & 0xFF) * packed[0] + ((counts >> 8) & 0xFF) * packed[1] + ((counts >> 16) & 0xFF) * packed[2] + (counts >> 24) * packed[3];
+	}
+	//The average color of a cell of 2^N by 2^N pixels from its sums, rounded to the nearest
+	static inline BGRColor Average(uint64_t sums, int sizeShift) {
+		int shift = sizeShift * 2;
+		uint64_t half = (uint64_t)1 << (shift - 1);
+		sums += half | (half << 16) | (half << 32);
+		return BGRColor((uint8_t)((sums & 0xFFFF) >> shift), (uint8_t)(((sums >> 16) & 0xFFFF) >> shift), (uint8_t)((sums >> 32) >> shift));
+	}
 public:
-	//Decodes the image data to a user provided RGB array
+	//Decodes the image data to a user provided surface in any of the supported output formats. The image is cropped to
+	//the surface size if it is smaller. The surface is split into tiles which are decoded in parallel.
+	static void DecodeImage(CompressedImage& image, const OutputSurface& surface);
+	//The most a decoding task writes to the surface. A tile this size stays in L2 (along with its regions, which are
+	//far smaller) until it's done, instead of being evicted by the far end of a wide row.
+	static const int TileSizeBytes = 256 * 1024;
+	//How many regions wide the tiles of a surface are. Tiles are never less than one region, or more than a region row.
+	static int TileRegionsWide(CompressedImage& image, const OutputSurface& surface);
+	//Decodes a tile -- a run of regions in a row -- into the output surface, for callers that schedule the tiles
+	//themselves. Tiles write to disjoint parts of the surface, so any number can run at once.
+	static void DecodeTile(CompressedImage& image, int regionX, int regionY, int regionCount, const OutputSurface& surface);
+	//Decodes a single row of regions into the output surface
+	static inline void DecodeRegionRow(CompressedImage& image, int regionY, const OutputSurface& surface) { DecodeTile(image, 0, regionY, image.RegionsWide(), surface); }
+	//Decodes only the regions the decoder replaced since the surface was last brought up to date, and leaves the rest of
+	//its pixels as they are, so the cost follows the bitrate rather than the resolution. The surface has to keep its
+	//contents from call to call. The versions are the RegionVersion()s the surface is up to date with, and are updated
+	//(an empty vector decodes everything). Returns how many regions were decoded.
+	static int DecodeChangedRegions(CompressedImage& image, const OutputSurface& surface, std::vector<uint32_t>& decodedVersions);
+	//A run of regions in a row, decoded by DecodeTile()
+	struct Tile {
+		int RegionX, RegionY, RegionCount;
+	};
+	//Finds the tiles DecodeChangedRegions() would decode and updates the versions as if they had been, for callers that
+	//schedule the tiles themselves
+	static void FindChangedTiles(CompressedImage& image, const OutputSurface& surface, std::vector<uint32_t>& decodedVersions, std::vector<Tile>& tiles);
+	//Decodes the image data to a user provided RGB array. The image is cropped to the array size if it is smaller.
 	static void DecodeImageToBGRArray(CompressedImage& image, BGRColor* arr, int arrWidth, int arrHeight);
+	//Decodes the image at 1/2, 1/4 or 1/8 of its size (the scale is 2, 4 or 8), e.g. for thumbnails. Each pixel is the
+	//average of the ones it covers, worked out from the blend factors of the blocks without decoding any pixels: at 1/8
+	//each block becomes a single pixel. The surface should be ScaledSize() of the source size; it's cropped as usual.
+	static void DecodeImageScaled(CompressedImage& image, const OutputSurface& surface, int scale);
+	//Decodes a single row of regions of a scaled image
+	static void DecodeRegionRowScaled(CompressedImage& image, int regionY, const OutputSurface& surface, int scale);
+	//The size of a scaled image, given the source size
+	static inline int ScaledSize(int size, int scale) { return (size + scale - 1) / scale; }
 	//Decodes an image to an RGB array (which is created for the image data)
 	static BGRColor* DecodeImageToBGRArray(CompressedImage& image);
+	//Reads the source image size from a serialized image's header
+	static void ReadImageSize(uint8_t* serializedData, int* width, int* height);
+	//Returns whether a serialized image picks its block sizes to suit the content
+	static bool IsAdaptive(uint8_t* serializedData);
+	//Returns whether a serialized image leaves out unchanged blocks of the regions it sends
+	static bool HasTemporalBlocks(uint8_t* serializedData);
+	//Returns whether a serialized image codes blocks of one color in just that color
+	static bool HasSolidBlocks(uint8_t* serializedData);
+	//Returns whether a serialized image's blocks have YCoCg colors
+	static bool HasYCoCgColors(uint8_t* serializedData);
+	//Returns whether a serialized image copies regions from long-term references
+	static bool HasReferences(uint8_t* serializedData);
+	//Returns whether a serialized image has every region (and block) present, i.e. decoding can start from it
+	static bool IsKeyframe(uint8_t* serializedData);
 	//Deserializes an image object from its binary representation
 	static CompressedImage& DeserializeImage(uint8_t* serializedData);
-	//Deserializes an image object from its binary representation
-	static void DeserializeImage(CompressedImage& image, uint8_t* serializedData);
-};
+	//Deserializes an image object from its binary representation, on top of the previous frame. Streams which use
+	//long-term references need the decoder's set of them, which is kept up to date as the frames go by.
+	static void DeserializeImage(CompressedImage& image, uint8_t* serializedData, ReferenceSet* references = nullptr);
 
+	//The steps of DeserializeImage(), for callers that get a frame's regions piecemeal (e.g. in packets):
+	//ReadFrameHeader() once per frame, then DeserializeRegions() for each run of regions, in any order.
+
+	//Reads a frame's 4 byte header (size and flags) into the image, and gets the references ready for the frame
+	static void ReadFrameHeader(CompressedImage& image, uint8_t* serializedData, ReferenceSet* references = nullptr);
+	//Deserializes a run of regions, given the run's part of the region table and reference table (bit 0 for the first
+	//region of the run), its reference numbers and its region data. Returns the end of the region data.
+	static uint8_t* DeserializeRegions(CompressedImage& image, int firstRegion, int regionCount, uint8_t* regionTable, uint8_t* referenceTable, uint8_t* referenceNumbers, uint8_t* regionData, ReferenceSet* references = nullptr);
+	//The size of a serialized region, without reading it in
+	static int RegionSizeBytes(uint8_t* serializedRegion, bool adaptive, bool temporalBlocks, bool solidBlocks);
+	//Walks a run of serialized regions, checking that each one is all there and that its block table only names blocks
+	//within the region. Returns the end of the run, or nullptr if it runs past the end or a region is malformed.
+	static uint8_t* CheckRegions(uint8_t* regionData, uint8_t* end, int regionCount, bool adaptive, bool temporalBlocks, bool solidBlocks);
+	//The size of a serialized image, without reading it in, or -1 if it runs past the available bytes (e.g. it was
+	//cut off), is malformed (see CheckRegions()) or copies a region from a reference past the first referenceCount
+	static int64_t SerializedSizeBytes(uint8_t* serializedData, int64_t availableBytes, int referenceCount = ReferenceSet::MaxReferences);
+};
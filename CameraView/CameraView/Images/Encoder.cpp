@@ -1,9 +1,17 @@
 #include "Encoder.h"
 #include <climits>
+#include <cstring>
 
-void Encoder::WriteByte(std::vector<uint8_t> chars, uint8_t u)
+void Encoder::WriteByte(uint8_t** ptr, uint8_t u)
 {
-	chars.push_back(u);
+	*(*ptr)++ = u;
+}
+
+void Encoder::WriteUInt16(uint8_t** ptr, uint16_t u)
+{
+	//Big endian, same as the colors
+	WriteByte(ptr, (uint8_t)(u >> 8));
+	WriteByte(ptr, (uint8_t)(u & 0xFF));
 }
 
 
@@ -16,44 +24,142 @@ Encoder::~Encoder()
 {
 }
 
-void Encoder::EncodeRegion(std::vector<uint8_t> chars, Region& region) {
+void Encoder::EncodeRegion(uint8_t** ptr, Region& region, bool adaptive, bool temporalBlocks, bool solidBlocks) {
+	if (adaptive) {
+		WriteByte(ptr, (uint8_t)region.Mode);
+		//A whole region is just the one block
+		if (region.Mode == Region::MODE_WHOLE) {
+			EncodeBlock(ptr, region.Blocks[0]);
+			return;
+		}
+	}
 	//Write the block table
 	for (int i = 0; i < Region::BlockTableSizeBytes; i++) {
-		WriteByte(chars, region.BlockTable[i]);
+		WriteByte(ptr, region.BlockTable[i]);
+	}
+	//Which blocks are unchanged from the previous frame
+	if (temporalBlocks)
+		WriteUInt16(ptr, region.TemporalMask);
+	//Adaptive regions say which blocks are split
+	if (adaptive) {
+		uint16_t splitMask = 0;
+		for (int i = 0; i < Region::BlockCount; i++)
+			if (region.Blocks[i].Split)
+				splitMask |= 1 << i;
+		WriteUInt16(ptr, splitMask);
+	}
+	//And which are one color
+	uint16_t solidMask = 0;
+	if (solidBlocks) {
+		solidMask = region.SolidMask();
+		WriteUInt16(ptr, solidMask);
 	}
 	//And write the blocks
 	for (int blockY = 0; blockY < Region::BlocksPerColumn; blockY++) {
 		for (int blockX = 0; blockX < Region::BlocksPerRow; blockX++) {
-			//...but only if they're present
-			if (region.IsBlockPresent(blockX, blockY)) {
-				Block& block = region.GetBlock(blockY, blockY);
-				//First the colors
-				WriteByte(chars, block.LowColor.BackingHigh());
-				WriteByte(chars, block.LowColor.BackingLow());
-				WriteByte(chars, block.HighColor.BackingHigh());
-				WriteByte(chars, block.HighColor.BackingLow());
-				//Then the blend factors
-				for (int i = 0; i < Block::PixelDataLengthBytes; i++) {
-					WriteByte(chars, block.PixelData[i]);
-				}
-			}
+			//...but only if they're present (and changed)
+			if (!region.IsBlockPresent(blockX, blockY) || (temporalBlocks && region.IsBlockTemporal(blockX, blockY)))
+				continue;
+			Block& block = region.GetBlock(blockX, blockY);
+			if (solidMask & (1 << (blockY * Region::BlocksPerRow + blockX)))
+				WriteUInt16(ptr, block.LowColor.Backing());
+			else
+				EncodeBlock(ptr, block);
 		}
 	}
 }
 
+void Encoder::EncodeBlock(uint8_t ** ptr, Block & block)
+{
+	//First the colors
+	WriteByte(ptr, block.LowColor.BackingHigh());
+	WriteByte(ptr, block.LowColor.BackingLow());
+	WriteByte(ptr, block.HighColor.BackingHigh());
+	WriteByte(ptr, block.HighColor.BackingLow());
+	//And the other quarters' colors, if it's split
+	if (block.Split) {
+		for (int i = 0; i < (Block::QuarterCount - 1) * 2; i++)
+			WriteUInt16(ptr, block.QuarterColors[i].Backing());
+	}
+	//Then the blend factors
+	for (int i = 0; i < Block::PixelDataLengthBytes; i++) {
+		WriteByte(ptr, block.PixelData[i]);
+	}
+}
+
+int Encoder::MaxEncodedSize(CompressedImage & image)
+{
+	return MaxEncodedSize(image.RegionsWide() * image.RegionsTall(), image.Adaptive(), image.TemporalBlocks(), image.References(), image.SolidBlocks());
+}
+
+int Encoder::MaxEncodedSize(int regionCount, bool adaptive, bool temporalBlocks, bool references, bool solidBlocks)
+{
+	int regionSize = (adaptive ? Region::AdaptiveSizeBytes : Region::SizeBytes) + (temporalBlocks ? Region::TemporalSizeBytes : 0) + (solidBlocks ? Region::SolidSizeBytes : 0);
+	//A region copied from a reference takes a byte instead of itself, so only the reference table adds to the size
+	int referenceTableSize = references ? (regionCount + 7) / 8 : 0;
+	return 4 + (regionCount + 7) / 8 + referenceTableSize + regionCount * regionSize;
+}
+
 std::vector<uint8_t> Encoder::EncodeImage(CompressedImage & image)
 {
-	std::vector<uint8_t> chars;
-	//Broken, TODO
-	//Write the image size (but to minimize space usage, write the number of regions instead) 
-	WriteByte(chars, (uint8_t)image.RegionsWide());
-	WriteByte(chars, (uint8_t)image.RegionsTall());
+	std::vector<uint8_t> chars(MaxEncodedSize(image));
+	chars.resize(EncodeImage(image, nullptr, chars.data()));
+	return chars;
+}
+
+std::vector<uint8_t> Encoder::EncodeImage(CompressedImage & image, ImageDiff & differences)
+{
+	std::vector<uint8_t> chars(MaxEncodedSize(image));
+	chars.resize(EncodeImage(image, &differences, chars.data()));
+	return chars;
+}
+
+int Encoder::EncodeImage(CompressedImage & image, ImageDiff * differences, uint8_t * output)
+{
+	uint8_t* ptr = output;
+	//Write the source image size. 16 bits each, less the flags, so up to 8191x16383 (still enough for 8K)
+	WriteUInt16(&ptr, (uint16_t)(image.SourceWidth() | (image.Adaptive() ? CompressedImage::AdaptiveSizeFlag : 0) | (image.References() ? CompressedImage::ReferencesSizeFlag : 0) | (image.YCoCgColors() ? CompressedImage::YCoCgColorsSizeFlag : 0)));
+	WriteUInt16(&ptr, (uint16_t)(image.SourceHeight() | (image.TemporalBlocks() ? CompressedImage::TemporalBlocksSizeFlag : 0) | (image.SolidBlocks() ? CompressedImage::SolidBlocksSizeFlag : 0)));
 
+	//Write the region table: 1 bit per region, set if the region is present in the stream
+	uint8_t tableByte = 0;
+	int i = 0;
 	for (int y = 0; y < image.RegionsTall(); y++) {
-		for (int x = 0; y < image.RegionsWide(); x++) {
-			EncodeRegion(chars, image.GetRegion(x, y));
+		for (int x = 0; x < image.RegionsWide(); x++) {
+			if (differences == nullptr || differences->IsPresent(x, y))
+				tableByte |= 1 << (i % 8);
+			if (++i % 8 == 0) {
+				WriteByte(&ptr, tableByte);
+				tableByte = 0;
+			}
+		}
+	}
+	if (i % 8 != 0)
+		WriteByte(&ptr, tableByte);
+
+	//Then the reference table, the same way, and the reference each of the referenced regions is copied from
+	if (image.References()) {
+		uint8_t* referenceTable = ptr;
+		int regionCount = image.RegionsWide() * image.RegionsTall();
+		memset(referenceTable, 0, (regionCount + 7) / 8);
+		ptr += (regionCount + 7) / 8;
+		i = 0;
+		for (int y = 0; y < image.RegionsTall(); y++) {
+			for (int x = 0; x < image.RegionsWide(); x++, i++) {
+				if (differences != nullptr && differences->IsReferenced(x, y)) {
+					referenceTable[i / 8] |= 1 << (i % 8);
+					WriteByte(&ptr, (uint8_t)differences->RegionReference(x, y));
+				}
+			}
 		}
 	}
-	return chars;
-}
 
+	//And the regions which changed
+	for (int y = 0; y < image.RegionsTall(); y++) {
+		for (int x = 0; x < image.RegionsWide(); x++) {
+			if (differences == nullptr || differences->IsPresent(x, y))
+				EncodeRegion(&ptr, image.GetRegion(x, y), image.Adaptive(), image.TemporalBlocks(), image.SolidBlocks());
+		}
+	}
+	return (int)(ptr - output);
+}
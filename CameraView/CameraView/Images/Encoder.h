@@ -2,6 +2,7 @@
 #include <vector>
 #include <stdint.h>
 #include "CompressedImage.h"
+#include "ImageDiff.h"
 #include "Block.h"
 #include "Region.h"
 class Encoder
@@ -9,9 +10,23 @@ class Encoder
 private:
 	Encoder();
 	~Encoder();
-	void WriteByte(std::vector<uint8_t> chars, uint8_t byte);
-	void EncodeRegion(std::vector<uint8_t> chars, Region& r);
+	static void WriteByte(uint8_t** ptr, uint8_t byte);
+	static void WriteUInt16(uint8_t** ptr, uint16_t value);
+	static void EncodeRegion(uint8_t** ptr, Region& r, bool adaptive, bool temporalBlocks, bool solidBlocks);
+	static void EncodeBlock(uint8_t** ptr, Block& block);
 public:
-	std::vector<uint8_t> EncodeImage(CompressedImage& image);
+	//The largest an image of this size can be once serialized (every region present, no deduplicated blocks)
+	static int MaxEncodedSize(CompressedImage& image);
+	//The largest an image with this many regions, coded this way, can be once serialized
+	static int MaxEncodedSize(int regionCount, bool adaptive, bool temporalBlocks, bool references, bool solidBlocks);
+
+	//Serializes an image with every region present (e.g. the first frame of a stream)
+	static std::vector<uint8_t> EncodeImage(CompressedImage& image);
+	//Serializes an image, leaving out every region the diff marks as similar to the previous frame (or as copied from
+	//a long-term reference, if the image uses them)
+	static std::vector<uint8_t> EncodeImage(CompressedImage& image, ImageDiff& differences);
+	//Serializes an image straight into a caller provided buffer of at least MaxEncodedSize() bytes (e.g. a shared memory
+	//ring). Returns the number of bytes written. Pass a null diff to write every region.
+	static int EncodeImage(CompressedImage& image, ImageDiff* differences, uint8_t* output);
 	template <typename T> T SwapEndian(T u);
-};
\ No newline at end of file
+};
@@ -0,0 +1,150 @@
+#include "EncoderHost.h"
+
+EncoderHost::EncoderHost(Scheduler & scheduler) : _Scheduler(scheduler)
+{
+}
+
+EncoderHost::~EncoderHost()
+{
+	WaitForIdle();
+}
+
+int EncoderHost::AddStream(int width, int height, double framesPerSecond, int similarityThreshold, FrameCallback onFrameEncoded, int maxFramesInFlight)
+{
+	std::unique_lock<std::mutex> lock(_Mutex);
+	int id = (int)_Streams.size();
+	Stream* stream = new Stream(id, width, height, similarityThreshold, maxFramesInFlight);
+	stream->FrameInterval = std::chrono::duration_cast<Scheduler::Clock::duration>(std::chrono::duration<double>(1 / framesPerSecond));
+	stream->OnFrameEncoded = onFrameEncoded;
+	_Streams.push_back(std::unique_ptr<Stream>(stream));
+	return id;
+}
+
+void EncoderHost::RequestKeyframe(int streamId)
+{
+	//Frames are started with the lock held, so this can't land halfway through one
+	std::unique_lock<std::mutex> lock(_Mutex);
+	_Streams[streamId]->Encoder.RequestKeyframe();
+}
+
+EncoderHost::FrameHandle EncoderHost::SubmitFrame(int streamId, const InputFrame & frame)
+{
+	std::unique_lock<std::mutex> lock(_Mutex);
+	Stream* stream = _Streams[streamId].get();
+
+	auto now = Scheduler::Clock::now();
+	if (stream->FramesEncoded == 0 && stream->Idle())
+		stream->FirstSubmitted = now;
+
+	QueuedFrame* queued = new QueuedFrame();
+	queued->Frame = frame;
+	queued->Submitted = now;
+	queued->Deadline = now + stream->FrameInterval;
+	FrameHandle handle = queued->Result.get_future().share();
+	stream->Pending.push_back(std::unique_ptr<QueuedFrame>(queued));
+
+	StartFrames(stream);
+	return handle;
+}
+
+void EncoderHost::StartFrames(Stream * stream)
+{
+	auto now = Scheduler::Clock::now();
+	while (!stream->Pending.empty() && (int)stream->InFlight.size() < stream->Encoder.MaxFramesInFlight()) {
+		QueuedFrame* frame = stream->Pending.front().get();
+		stream->InFlight.push_back(std::move(stream->Pending.front()));
+		stream->Pending.pop_front();
+
+		//A frame which is overdue already doesn't jump the queue ahead of the streams which are on time
+		frame->QueueDeadline = frame->Deadline < now ? now + stream->FrameInterval : frame->Deadline;
+		//The encoder gets the real deadline, so it can cut corners to catch up (see StreamEncoder::HoldDeadlines())
+		frame->FrameNumber = stream->Encoder.BeginFrame(frame->Deadline);
+		frame->RowsRemaining = stream->Encoder.RegionsTall();
+		//Only the rows whose reference is already done can go now; the rest are queued as the previous frame gets to them
+		for (int y = 0; y < stream->Encoder.RegionsTall(); y++)
+			if (stream->RowProgress[y] == frame->FrameNumber)
+				EnqueueRow(stream, frame, y);
+	}
+}
+
+void EncoderHost::EnqueueRow(Stream * stream, QueuedFrame * frame, int regionY)
+{
+	//The rows all share the frame's deadline, so they're interleaved with the other streams' by how urgent they are
+	_Scheduler.EnqueueBefore(frame->QueueDeadline, &EncoderHost::EncodeRow, this, stream, frame, regionY);
+}
+
+void EncoderHost::EncodeRow(Stream * stream, QueuedFrame * frame, int regionY)
+{
+	stream->Encoder.EncodeRegionRow(frame->FrameNumber, frame->Frame, regionY);
+
+	std::unique_lock<std::mutex> lock(_Mutex);
+	//Hand the row on to the next frame, if it has been started
+	stream->RowProgress[regionY]++;
+	int next = frame->FrameNumber + 1 - stream->InFlight.front()->FrameNumber;
+	if (next < (int)stream->InFlight.size())
+		EnqueueRow(stream, stream->InFlight[next].get(), regionY);
+
+	if (--frame->RowsRemaining == 0 && !stream->Finishing)
+		FinishFrames(stream, lock);
+}
+
+void EncoderHost::FinishFrames(Stream * stream, std::unique_lock<std::mutex>& lock)
+{
+	stream->Finishing = true;
+	while (!stream->InFlight.empty() && stream->InFlight.front()->RowsRemaining == 0) {
+		QueuedFrame* frame = stream->InFlight.front().get();
+
+		//Serializing only reads the frame's own slot, so the frames behind it can keep encoding meanwhile
+		lock.unlock();
+		std::vector<uint8_t> serialized = stream->Encoder.FinishFrame(frame->FrameNumber);
+		auto now = Scheduler::Clock::now();
+		if (stream->OnFrameEncoded)
+			stream->OnFrameEncoded(stream->Id, serialized);
+		size_t length = serialized.size();
+		frame->Result.set_value(std::move(serialized));
+		lock.lock();
+
+		double latency = std::chrono::duration<double>(now - frame->Submitted).count();
+		stream->FramesEncoded++;
+		stream->BytesEncoded += length;
+		stream->TotalLatencySecs += latency;
+		if (latency > stream->MaxLatencySecs)
+			stream->MaxLatencySecs = latency;
+		if (now > frame->Deadline)
+			stream->DeadlineMisses++;
+		stream->LastCompleted = now;
+
+		//Its slot is free now
+		stream->InFlight.pop_front();
+		StartFrames(stream);
+	}
+	stream->Finishing = false;
+
+	if (stream->Idle())
+		_Idle.notify_all();
+}
+
+void EncoderHost::WaitForIdle()
+{
+	std::unique_lock<std::mutex> lock(_Mutex);
+	_Idle.wait(lock, [this] {
+		for (auto& stream : _Streams)
+			if (!stream->Idle())
+				return false;
+		return true;
+	});
+}
+
+void EncoderHost::GetStatistics(int streamId, int * framesEncoded, int64_t * bytesEncoded, double * framesPerSecond, double * averageLatencySecs, double * maxLatencySecs, int * deadlineMisses)
+{
+	std::unique_lock<std::mutex> lock(_Mutex);
+	Stream* stream = _Streams[streamId].get();
+
+	*framesEncoded = stream->FramesEncoded;
+	*bytesEncoded = stream->BytesEncoded;
+	double elapsed = std::chrono::duration<double>(stream->LastCompleted - stream->FirstSubmitted).count();
+	*framesPerSecond = stream->FramesEncoded > 0 && elapsed > 0 ? stream->FramesEncoded / elapsed : 0;
+	*averageLatencySecs = stream->FramesEncoded > 0 ? stream->TotalLatencySecs / stream->FramesEncoded : 0;
+	*maxLatencySecs = stream->MaxLatencySecs;
+	*deadlineMisses = stream->DeadlineMisses;
+}
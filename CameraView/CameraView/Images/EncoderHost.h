@@ -0,0 +1,110 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <future>
+#include <stdint.h>
+#include "BGRColor.h"
+#include "StreamEncoder.h"
+#include "..\Scheduler.h"
+
+//Encodes many streams at once on a shared scheduler.
+//
+//Every submitted frame is split into one task per row of regions, and the tasks of all the streams go to the same
+//earliest-deadline-first queue. That way small frames from many streams are batched together to fill the cores,
+//and the stream whose frame is due soonest is worked on first.
+//
+//Each stream keeps up to a set number of frames in flight. A row of regions needs the same row of the previous frame
+//as its temporal reference, so rows are released as a wavefront: row Y of frame N is queued once row Y of frame N-1
+//is done. Frames are always finished (and their callbacks called) in submission order. Capping the frames in flight
+//means a heavy stream can't flood the queue with rows, and a frame which is only started once its deadline has passed
+//(its stream fell behind) is queued as if it was due a frame interval from then. Otherwise the lagging stream's
+//overdue frames would always come first, and starve the streams which are keeping up.
+class EncoderHost
+{
+public:
+	//Called on a worker thread when a stream's frame has been encoded
+	typedef std::function<void(int streamId, std::vector<uint8_t>& serializedFrame)> FrameCallback;
+	//Becomes ready with the serialized frame once it has been encoded (after the stream's callback has run)
+	typedef std::shared_future<std::vector<uint8_t>> FrameHandle;
+private:
+	struct QueuedFrame {
+		InputFrame Frame;
+		Scheduler::TimePoint Submitted;
+		Scheduler::TimePoint Deadline;
+		//When the frame's rows are due in the queue: its deadline, or a frame interval from when it was started if that
+		//was already past
+		Scheduler::TimePoint QueueDeadline;
+		//The stream encoder's number for the frame, once it has been started
+		int FrameNumber = -1;
+		int RowsRemaining = 0;
+		std::promise<std::vector<uint8_t>> Result;
+	};
+	struct Stream {
+		int Id;
+		StreamEncoder Encoder;
+		Scheduler::Clock::duration FrameInterval;
+		FrameCallback OnFrameEncoded;
+
+		//Frames waiting for a free slot
+		std::deque<std::unique_ptr<QueuedFrame>> Pending;
+		//Frames being encoded, oldest first
+		std::deque<std::unique_ptr<QueuedFrame>> InFlight;
+		//For each row of regions, the number of the frame which may encode it next
+		std::vector<int> RowProgress;
+		//Whether a worker is finishing frames, so they're finished in order by one thread at a time
+		bool Finishing = false;
+
+		//Statistics
+		int FramesEncoded = 0;
+		int64_t BytesEncoded = 0;
+		double TotalLatencySecs = 0, MaxLatencySecs = 0;
+		int DeadlineMisses = 0;
+		Scheduler::TimePoint FirstSubmitted, LastCompleted;
+
+		Stream(int id, int width, int height, int similarityThreshold, int maxFramesInFlight) :
+			Id(id), Encoder(width, height, similarityThreshold, maxFramesInFlight), RowProgress(Encoder.RegionsTall(), 0) {}
+		inline bool Idle() { return Pending.empty() && InFlight.empty() && !Finishing; }
+	};
+
+	Scheduler& _Scheduler;
+	std::vector<std::unique_ptr<Stream>> _Streams;
+	std::mutex _Mutex;
+	std::condition_variable _Idle;
+
+	//Starts as many of the stream's pending frames as there are free slots for. Must hold _Mutex.
+	void StartFrames(Stream* stream);
+	//Queues a row of a frame in flight. Must hold _Mutex.
+	void EnqueueRow(Stream* stream, QueuedFrame* frame, int regionY);
+	void EncodeRow(Stream* stream, QueuedFrame* frame, int regionY);
+	//Finishes the stream's oldest frames for as long as they have all their rows done
+	void FinishFrames(Stream* stream, std::unique_lock<std::mutex>& lock);
+public:
+	EncoderHost(Scheduler& scheduler = CompressedImage::Pool());
+	//Waits for all the submitted frames to be encoded
+	~EncoderHost();
+
+	//Registers a stream and returns its id. The frame rate sets the deadline of each frame (1 frame interval after it is submitted).
+	//The callback may be null if the frames are collected through their handles instead.
+	int AddStream(int width, int height, double framesPerSecond, int similarityThreshold, FrameCallback onFrameEncoded, int maxFramesInFlight = 2);
+
+	//Gets a stream's encoder, to change its settings (keyframe interval, intra refresh...). Do so before submitting frames.
+	inline StreamEncoder& GetStreamEncoder(int streamId) { return _Streams[streamId]->Encoder; }
+	//Makes the stream's next frame a keyframe. Safe to call at any time.
+	void RequestKeyframe(int streamId);
+
+	//Queues a frame for encoding and returns right away. The frame's data must stay valid until it has been encoded,
+	//so a capture loop needs at least one more buffer than the stream has frames in flight.
+	FrameHandle SubmitFrame(int streamId, const InputFrame& frame);
+	inline FrameHandle SubmitFrame(int streamId, BGRColor* colorData) { return SubmitFrame(streamId, InputFrame::BGR24(colorData, GetStreamEncoder(streamId).Width())); }
+
+	//Blocks until every submitted frame has been encoded
+	void WaitForIdle();
+
+	//Gets a stream's throughput and latency (from submission to encoded) so far
+	void GetStatistics(int streamId, int* framesEncoded, int64_t* bytesEncoded, double* framesPerSecond, double* averageLatencySecs, double* maxLatencySecs, int* deadlineMisses);
+};
@@ -8,14 +8,28 @@ private:
 	int _SimilarityThreshold;
 	int _RegionsWide, _RegionsTall;
 	Array2D<int> _RegionDiffs;
+	Array2D<int> _RegionReferences;
 public:
+	//The reference of a region which isn't copied from a long-term reference
+	static const int NoReference = -1;
+
 	inline int& SimilarityThreshold() { return _SimilarityThreshold; }
 	inline int Width() { return _RegionsWide * Region::Width; }
 	inline int Height() { return _RegionsTall * Region::Height; }
 	inline int RegionsWide() { return _RegionsWide; }
 	inline int RegionsTall() { return _RegionsTall; }
 
-	ImageDiff(CompressedImage& prev, CompressedImage& curr, int similarityThreshold = 768) : _RegionDiffs(prev.Width() / Region::Width, prev.Height() / Region::Height)
+	//Creates an empty diff, to be filled in with DiffRow()
+	ImageDiff(int regionsWide, int regionsTall, int similarityThreshold = 768) : _RegionDiffs(regionsWide, regionsTall), _RegionReferences(regionsWide, regionsTall)
+	{
+		_RegionsWide = regionsWide;
+		_RegionsTall = regionsTall;
+		_SimilarityThreshold = similarityThreshold;
+		for (int i = 0; i < _RegionReferences.Count(); i++)
+			_RegionReferences[i] = NoReference;
+	}
+
+	ImageDiff(CompressedImage& prev, CompressedImage& curr, int similarityThreshold = 768) : _RegionDiffs(prev.RegionsWide(), prev.RegionsTall()), _RegionReferences(prev.RegionsWide(), prev.RegionsTall())
 	{
 		assert(prev.Width() == curr.Width());
 		assert(prev.Height() == curr.Height());
@@ -24,28 +38,48 @@ public:
 		_RegionsTall = prev.RegionsTall();
 		_SimilarityThreshold = similarityThreshold;
 
+		//One task per row of regions, same as the encoder
+		std::vector<std::future<void>> futures;
 		for (int y = 0; y < prev.RegionsTall(); y++)
-			for (int x = 0; x < prev.RegionsWide(); x++)
+			futures.push_back(CompressedImage::Pool().Enqueue([this, &prev, &curr, y] { DiffRow(prev, curr, y); }));
+
+		for (size_t i = 0; i < futures.size(); i++)
+			futures[i].wait();
+	}
+
+	//Compares a single row of regions. Used to diff a frame row by row as its regions are built.
+	void DiffRow(CompressedImage& prev, CompressedImage& curr, int y)
+	{
+		for (int x = 0; x < prev.RegionsWide(); x++)
+		{
+			RegionDifference(x, y) = Compare(prev.GetRegion(x, y), curr.GetRegion(x, y));
+			RegionReference(x, y) = NoReference;
+		}
+	}
+
+	//Gets the largest per-block difference between two regions
+	static int Compare(Region& pRegion, Region& cRegion)
+	{
+		int largestRegionDiff = 0;
+		for (int blockY = 0; blockY < Region::BlocksPerColumn; blockY++) {
+			for (int blockX = 0; blockX < Region::BlocksPerRow; blockX++)
 			{
-				Region& pRegion = prev.GetRegion(x, y);
-				Region& cRegion = curr.GetRegion(x, y);
-
-				int largestRegionDiff = 0;
-				for (int blockY = 0; blockY < Region::BlocksPerColumn; blockY++) {
-					for (int blockX = 0; blockX < Region::BlocksPerRow; blockX++)
-					{
-						//Compare the blocks
-						int diff = Block::DifferenceFactor(pRegion.GetBlock(blockX, blockY), cRegion.GetBlock(blockX, blockY));
-						if (diff > largestRegionDiff)
-							largestRegionDiff = diff;
-					}
-				}
-				RegionDifference(x, y) = largestRegionDiff;
+				//Compare the blocks
+				int diff = Block::DifferenceFactor(pRegion.GetBlock(blockX, blockY), cRegion.GetBlock(blockX, blockY));
+				if (diff > largestRegionDiff)
+					largestRegionDiff = diff;
 			}
+		}
+		return largestRegionDiff;
 	}
 
 	//Gets the largest per-block difference between the regions
 	inline int& RegionDifference(int x, int y) { return _RegionDiffs.Get(x, y); }
+	//Gets the long-term reference (see ReferenceSet) the region is copied from, or NoReference
+	inline int& RegionReference(int x, int y) { return _RegionReferences.Get(x, y); }
+	inline bool IsReferenced(int x, int y) { return RegionReference(x, y) != NoReference; }
+	//Whether the region is sent in the stream: it's neither the same as the previous frame's nor copied from a reference
+	inline bool IsPresent(int x, int y) { return !AreSimilar(x, y) && !IsReferenced(x, y); }
 
 	inline bool AreSimilar(int x, int y) { return RegionDifference(x, y) < _SimilarityThreshold; }
 
@@ -0,0 +1,82 @@
+#pragma once
+#include <stdint.h>
+#include "BGRColor.h"
+#include "BGRAColor.h"
+
+//Describes a frame handed to the encoder, in whatever format the camera produced it. Blocks are built straight from
+//it, so there's no need to convert the whole frame to BGR24 first.
+struct InputFrame
+{
+	enum PixelFormat {
+		//Packed 24 bit BGR (OpenCV's default)
+		FORMAT_BGR24,
+		//Packed 32 bit BGRA (or BGRX)
+		FORMAT_BGRA32,
+		//Packed 4:2:2 YUV: Y0 U Y1 V for every 2 pixels
+		FORMAT_YUYV,
+		//Planar 4:2:0 YUV: a full resolution Y plane followed by a half resolution plane of interleaved U and V
+		FORMAT_NV12
+	};
+
+	PixelFormat Format;
+	//The planes of the frame (only NV12 uses the second) and the number of bytes between the start of each row
+	uint8_t* Planes[2];
+	int Strides[2];
+
+	static InputFrame BGR24(BGRColor* data, int width) { return InputFrame{ FORMAT_BGR24, { (uint8_t*)data, nullptr }, { width * 3, 0 } }; }
+	static InputFrame BGRA32(uint8_t* data, int stride) { return InputFrame{ FORMAT_BGRA32, { data, nullptr }, { stride, 0 } }; }
+	static InputFrame YUYV(uint8_t* data, int stride) { return InputFrame{ FORMAT_YUYV, { data, nullptr }, { stride, 0 } }; }
+	static InputFrame NV12(uint8_t* yPlane, int yStride, uint8_t* uvPlane, int uvStride) { return InputFrame{ FORMAT_NV12, { yPlane, uvPlane }, { yStride, uvStride } }; }
+};
+
+//The readers for each format. They are template parameters of the rearranging code, so each one's conversion is
+//compiled straight into its own copy of the loop. ReadPixels converts <count> pixels of row y, starting at x.
+namespace InputFormats
+{
+	inline uint8_t Clamp(int value) { return (uint8_t)(value < 0 ? 0 : (value > 255 ? 255 : value)); }
+
+	//BT.601 limited range YUV to RGB, in 8.8 fixed point
+	inline BGRAColor FromYUV(int y, int u, int v) {
+		int c = (y - 16) * 298 + 128, d = u - 128, e = v - 128;
+		return BGRAColor(Clamp((c + 409 * e) >> 8), Clamp((c - 100 * d - 208 * e) >> 8), Clamp((c + 516 * d) >> 8));
+	}
+
+	struct BGR24 {
+		static inline void ReadPixels(const InputFrame& frame, int x, int y, int count, BGRAColor* output) {
+			uint8_t* pixel = frame.Planes[0] + y * frame.Strides[0] + x * 3;
+			for (int i = 0; i < count; i++, pixel += 3)
+				output[i] = BGRAColor(pixel[2], pixel[1], pixel[0]);
+		}
+	};
+
+	struct BGRA32 {
+		static inline void ReadPixels(const InputFrame& frame, int x, int y, int count, BGRAColor* output) {
+			//Already the right layout -- a straight copy of aligned 4 byte pixels
+			uint32_t* pixel = (uint32_t*)(frame.Planes[0] + y * frame.Strides[0]) + x;
+			for (int i = 0; i < count; i++)
+				((uint32_t*)output)[i] = pixel[i];
+		}
+	};
+
+	struct YUYV {
+		static inline void ReadPixels(const InputFrame& frame, int x, int y, int count, BGRAColor* output) {
+			uint8_t* row = frame.Planes[0] + y * frame.Strides[0];
+			for (int i = 0; i < count; i++) {
+				//Each 4 bytes hold 2 pixels which share their U and V
+				uint8_t* pair = row + ((x + i) >> 1) * 4;
+				output[i] = FromYUV(pair[((x + i) & 1) * 2], pair[1], pair[3]);
+			}
+		}
+	};
+
+	struct NV12 {
+		static inline void ReadPixels(const InputFrame& frame, int x, int y, int count, BGRAColor* output) {
+			uint8_t* luma = frame.Planes[0] + y * frame.Strides[0];
+			uint8_t* chroma = frame.Planes[1] + (y >> 1) * frame.Strides[1];
+			for (int i = 0; i < count; i++) {
+				uint8_t* uv = chroma + ((x + i) >> 1) * 2;
+				output[i] = FromYUV(luma[x + i], uv[0], uv[1]);
+			}
+		}
+	};
+}
@@ -0,0 +1,144 @@
+#include "LookaheadEncoder.h"
+#include <cassert>
+#include <climits>
+#include <cstdlib>
+#include <algorithm>
+
+LookaheadEncoder::LookaheadEncoder(int width, int height, int window, FrameCallback onFrameEncoded, int similarityThreshold) :
+	_Encoder(width, height, similarityThreshold), _OnFrameEncoded(onFrameEncoded)
+{
+	assert(window > 0);
+	_Window = window;
+	//Keyframes are placed from the window instead
+	_Encoder.KeyframeInterval() = 0;
+	_BlocksWide = _Encoder.Image().RegionsWide() * Region::BlocksPerRow;
+	_BlocksTall = _Encoder.RegionsTall() * Region::BlocksPerColumn;
+}
+
+LookaheadEncoder::~LookaheadEncoder()
+{
+	Flush();
+}
+
+void LookaheadEncoder::SubmitFrame(const BGRColor * colorData)
+{
+	BufferedFrame* frame = new BufferedFrame();
+	frame->Pixels.assign(colorData, colorData + _Encoder.Width() * _Encoder.Height());
+	frame->Analyzed = CompressedImage::Pool().Enqueue(&LookaheadEncoder::Analyze, this, frame);
+	_Frames.push_back(std::unique_ptr<BufferedFrame>(frame));
+
+	//The newest frame's analysis carries on while the oldest is encoded
+	if ((int)_Frames.size() > _Window)
+		EncodeOldest();
+}
+
+void LookaheadEncoder::Flush()
+{
+	while (!_Frames.empty())
+		EncodeOldest();
+}
+
+void LookaheadEncoder::Analyze(BufferedFrame * frame)
+{
+	int width = _Encoder.Width(), height = _Encoder.Height();
+	//BGRColor() leaves the channels unset, and the blocks of the padding past the bottom have no pixels to set them from
+	frame->BlockColors.assign(_BlocksWide * _BlocksTall, BGRColor(0, 0, 0));
+	for (int blockY = 0; blockY < _BlocksTall; blockY++) {
+		for (int blockX = 0; blockX < _BlocksWide; blockX++) {
+			//The blocks over the edge of the frame are averaged over the pixels they have
+			int left = blockX * Block::Width, top = blockY * Block::Height;
+			int right = std::min(left + Block::Width, width), bottom = std::min(top + Block::Height, height);
+			int b = 0, g = 0, r = 0, count = 0;
+			for (int y = top; y < bottom; y++) {
+				for (int x = left; x < right; x++) {
+					BGRColor& pixel = frame->Pixels[y * width + x];
+					b += pixel.B();
+					g += pixel.G();
+					r += pixel.R();
+				}
+				count += right - left;
+			}
+			if (count > 0)
+				frame->BlockColors[blockY * _BlocksWide + blockX] = BGRColor((uint8_t)(r / count), (uint8_t)(g / count), (uint8_t)(b / count));
+		}
+	}
+}
+
+void LookaheadEncoder::Compare(BufferedFrame * frame, std::vector<BGRColor>& previous)
+{
+	int regionsWide = _Encoder.Image().RegionsWide();
+	frame->RegionChanges.assign(regionsWide * _Encoder.RegionsTall(), 0);
+	int cutRegions = 0;
+	for (int regionY = 0; regionY < _Encoder.RegionsTall(); regionY++) {
+		for (int regionX = 0; regionX < regionsWide; regionX++) {
+			//With nothing to compare to, everything changed
+			int change = previous.empty() ? INT_MAX : 0;
+			for (int y = 0; y < Region::BlocksPerColumn && !previous.empty(); y++) {
+				int row = (regionY * Region::BlocksPerColumn + y) * _BlocksWide + regionX * Region::BlocksPerRow;
+				for (int x = 0; x < Region::BlocksPerRow; x++) {
+					BGRColor& c = frame->BlockColors[row + x];
+					BGRColor& p = previous[row + x];
+					change = std::max(change, abs(c.B() - p.B()) + abs(c.G() - p.G()) + abs(c.R() - p.R()));
+				}
+			}
+			frame->RegionChanges[regionY * regionsWide + regionX] = change;
+			if (change >= CutBlockDifference)
+				cutRegions++;
+		}
+	}
+	//Three quarters of the picture, the same as the encoder's own scene change detection
+	frame->IsCut = cutRegions * 4 >= (int)frame->RegionChanges.size() * 3;
+	frame->Compared = true;
+}
+
+void LookaheadEncoder::EncodeOldest()
+{
+	//The window the decisions are made from: the oldest frame and up to Window() - 1 after it
+	int window = std::min((int)_Frames.size(), _Window);
+	for (int i = 0; i < window; i++) {
+		BufferedFrame* frame = _Frames[i].get();
+		frame->Analyzed.wait();
+		if (!frame->Compared)
+			Compare(frame, i == 0 ? _PreviousBlockColors : _Frames[i - 1]->BlockColors);
+	}
+	BufferedFrame* oldest = _Frames.front().get();
+
+	//Keyframes go on the cuts. One which is due waits for a cut in the window, for as long as it's no more than a
+	//window late.
+	bool keyframe = oldest->IsCut;
+	if (!keyframe && _KeyframeInterval > 0 && _FramesSinceKeyframe >= _KeyframeInterval) {
+		keyframe = true;
+		for (int i = 1; i < window; i++) {
+			if (_Frames[i]->IsCut && _FramesSinceKeyframe + i < _KeyframeInterval + _Window) {
+				keyframe = false;
+				break;
+			}
+		}
+	}
+
+	//Each region's threshold goes from the target, for content which lasts the whole window, to twice it for content
+	//which is replaced by the next frame. At the end of the stream nothing lasts longer than the frames left.
+	int threshold = _Encoder.SimilarityThreshold();
+	std::vector<int>& thresholds = _Encoder.RegionThresholds();
+	thresholds.resize(oldest->RegionChanges.size());
+	for (size_t r = 0; r < thresholds.size(); r++) {
+		int lasts = 1;
+		while (lasts < window && _Frames[lasts]->RegionChanges[r] < ChangedBlockDifference)
+			lasts++;
+		thresholds[r] = (int)((int64_t)threshold * 2 * _Window / (_Window + lasts));
+	}
+
+	if (keyframe)
+		_Encoder.RequestKeyframe();
+	std::vector<uint8_t> serialized = _Encoder.EncodeFrame(oldest->Pixels.data());
+	if (_Encoder.IsKeyframe()) {
+		_FramesSinceKeyframe = 0;
+		_Keyframes++;
+	}
+	_FramesSinceKeyframe++;
+	if (_OnFrameEncoded)
+		_OnFrameEncoded(serialized);
+
+	_PreviousBlockColors = std::move(oldest->BlockColors);
+	_Frames.pop_front();
+}
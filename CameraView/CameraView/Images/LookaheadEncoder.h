@@ -0,0 +1,81 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <future>
+#include <stdint.h>
+#include "BGRColor.h"
+#include "StreamEncoder.h"
+
+//Encodes a stream offline (transcodes, archives) with a look at the frames to come, rather than only the one before.
+//
+//The last Window() frames submitted are held back. Each is analyzed on the shared scheduler as soon as it arrives --
+//the frames of the window are analyzed in parallel with each other and with the encoding -- down to the average color
+//of every block. When the oldest frame is encoded, the window decides:
+// - Where keyframes go: on the cuts, and an interval keyframe is put off to a cut coming up in the window rather than
+//   being sent just before it.
+// - How close each region has to stay to the previous frame to be reused: a region whose content will be replaced
+//   within a frame or two gets up to twice SimilarityThreshold(), one which stays put for the whole window gets
+//   SimilarityThreshold() itself. Errors which are seen for long are held to the target; ones which are gone in a
+//   frame are let through, and the bytes saved with them.
+//Frames come out (through the callback, on the caller's thread) in order, Window() frames after they went in.
+class LookaheadEncoder
+{
+public:
+	//Called with each frame once it has been encoded
+	typedef std::function<void(std::vector<uint8_t>& serializedFrame)> FrameCallback;
+
+	//How much a block's average color has to move (the sum of the channels' differences) for its region to count as changed
+	static const int ChangedBlockDifference = 16;
+	//And for it to count towards a cut
+	static const int CutBlockDifference = 96;
+private:
+	struct BufferedFrame {
+		std::vector<BGRColor> Pixels;
+		//The average color of each block, which the frames are compared by
+		std::vector<BGRColor> BlockColors;
+		std::future<void> Analyzed;
+		//How much each region moved on from the frame before (the most any of its blocks did), once compared
+		std::vector<int> RegionChanges;
+		bool Compared = false;
+		bool IsCut = false;
+	};
+
+	StreamEncoder _Encoder;
+	FrameCallback _OnFrameEncoded;
+	int _Window;
+	int _KeyframeInterval = 0;
+	int _FramesSinceKeyframe = 0;
+	int _Keyframes = 0;
+	int _BlocksWide, _BlocksTall;
+	std::deque<std::unique_ptr<BufferedFrame>> _Frames;
+	//The block colors of the last frame encoded, for comparing the next one to
+	std::vector<BGRColor> _PreviousBlockColors;
+
+	void Analyze(BufferedFrame* frame);
+	void Compare(BufferedFrame* frame, std::vector<BGRColor>& previous);
+	//Decides about the oldest frame from the ones after it, then encodes it
+	void EncodeOldest();
+public:
+	//Holds back <window> frames (at least 1). The similarity threshold is the target, which regions are held to when
+	//their content lasts.
+	LookaheadEncoder(int width, int height, int window, FrameCallback onFrameEncoded, int similarityThreshold = 768);
+	//Encodes the frames still held back
+	~LookaheadEncoder();
+
+	inline int Window() { return _Window; }
+	//Sends a keyframe at least every N frames (or up to Window() frames later, to land it on a cut). 0 only sends them
+	//on the first frame and the cuts.
+	inline int& KeyframeInterval() { return _KeyframeInterval; }
+	//The encoder the frames go through, for its other settings (adaptive block sizes, references...). Its keyframe
+	//interval and region thresholds are managed by the lookahead.
+	inline StreamEncoder& Encoder() { return _Encoder; }
+	//How many keyframes were sent so far
+	inline int Keyframes() { return _Keyframes; }
+
+	//Copies in a frame from a row-ordered RGB array. Encodes the oldest frame held back if the window is full.
+	void SubmitFrame(const BGRColor* colorData);
+	//Encodes every frame held back
+	void Flush();
+};
@@ -0,0 +1,94 @@
+#pragma once
+#include <stdint.h>
+#include <algorithm>
+#include "BGRColor.h"
+#include "RGB565Color.h"
+#include "Block.h"
+#include "..\Kernels\Kernels.h"
+
+//Describes where to decode an image to: a surface in the format the display or compositor wants, with any row pitch.
+//Decoding straight into it saves a second conversion pass over every frame.
+struct OutputSurface
+{
+	enum PixelFormat {
+		//Packed 24 bit BGR (OpenCV's default)
+		FORMAT_BGR24,
+		//32 bit BGRA, alpha always 255
+		FORMAT_BGRA32,
+		//16 bit RGB 565, native endian
+		FORMAT_RGB565
+	};
+
+	PixelFormat Format;
+	uint8_t* Data;
+	//The number of bytes between the start of each row
+	int Stride;
+	//The size of the surface. The image is cropped to it if it is smaller.
+	int Width, Height;
+
+	inline int BytesPerPixel() const { return Format == FORMAT_BGR24 ? 3 : Format == FORMAT_BGRA32 ? 4 : 2; }
+
+	static OutputSurface BGR24(BGRColor* data, int width, int height) { return OutputSurface{ FORMAT_BGR24, (uint8_t*)data, width * 3, width, height }; }
+	static OutputSurface BGR24(uint8_t* data, int stride, int width, int height) { return OutputSurface{ FORMAT_BGR24, data, stride, width, height }; }
+	static OutputSurface BGRA32(uint8_t* data, int stride, int width, int height) { return OutputSurface{ FORMAT_BGRA32, data, stride, width, height }; }
+	static OutputSurface RGB565(uint8_t* data, int stride, int width, int height) { return OutputSurface{ FORMAT_RGB565, data, stride, width, height }; }
+};
+
+//The writers for each format. They are template parameters of the decoding loop, so each one is compiled straight into
+//its own copy of it. BuildPalette() converts a block's (or quarter's) 4 blend colors to the format once, then Write()
+//stores them. WriteRow() stores a whole row of a block, with the SIMD kernels where the format has them. FromBGR()
+//converts any other color, e.g. the averaged ones of a scaled decode. Fill() stores a run of one color (a solid block).
+namespace OutputFormats
+{
+	//The 4 blend colors between a block's two colors (in the block's format), as the decoder has always computed them
+	inline void BlendColors(RGB565Color low, RGB565Color high, Block::ColorFormat colors, BGRColor blends[4]) {
+		blends[0] = Block::DecodeColor(low, colors);
+		blends[3] = Block::DecodeColor(high, colors);
+		blends[1] = BGRColor::Blend(blends[0], blends[3], 0.33f);
+		blends[2] = BGRColor::Blend(blends[0], blends[3], 0.66f);
+	}
+
+	struct BGR24 {
+		typedef BGRColor Pixel;
+		static inline Pixel FromBGR(BGRColor color) { return color; }
+		static inline void BuildPalette(RGB565Color low, RGB565Color high, Block::ColorFormat colors, Pixel palette[4]) { BlendColors(low, high, colors, palette); }
+		static inline void Write(uint8_t* row, int x, Pixel pixel) { ((BGRColor*)row)[x] = pixel; }
+		static inline void Fill(uint8_t* row, int x, int count, Pixel pixel) { std::fill_n((BGRColor*)row + x, count, pixel); }
+		//Writes a whole row of a block from its blend factors
+		static inline void WriteRow(const Kernels::KernelTable& /*kernels*/, uint8_t* row, int x, const Pixel palette[4], int rowBits) {
+			for (int pixelX = 0; pixelX < Block::Width; pixelX++)
+				Write(row, x + pixelX, palette[(rowBits >> (pixelX * 2)) & 0b11]);
+		}
+	};
+
+	struct BGRA32 {
+		typedef uint32_t Pixel;
+		static inline Pixel FromBGR(BGRColor color) { return 0xFF000000u | (color.R() << 16) | (color.G() << 8) | color.B(); }
+		static inline void BuildPalette(RGB565Color low, RGB565Color high, Block::ColorFormat colors, Pixel palette[4]) {
+			BGRColor blends[4];
+			BlendColors(low, high, colors, blends);
+			for (int i = 0; i < 4; i++)
+				palette[i] = FromBGR(blends[i]);
+		}
+		//Whole, aligned 4 byte stores
+		static inline void Write(uint8_t* row, int x, Pixel pixel) { ((uint32_t*)row)[x] = pixel; }
+		//A plain fill, which the compiler turns into wide stores
+		static inline void Fill(uint8_t* row, int x, int count, Pixel pixel) { std::fill_n((uint32_t*)row + x, count, pixel); }
+		static inline void WriteRow(const Kernels::KernelTable& kernels, uint8_t* row, int x, const Pixel palette[4], int rowBits) { kernels.ExpandRow32((uint32_t*)row + x, palette, rowBits); }
+	};
+
+	struct RGB565 {
+		typedef uint16_t Pixel;
+		static inline Pixel FromBGR(BGRColor color) { return color.To565().Backing(); }
+		static inline void BuildPalette(RGB565Color low, RGB565Color high, Block::ColorFormat colors, Pixel palette[4]) {
+			BGRColor blends[4];
+			BlendColors(low, high, colors, blends);
+			//565 colors come back out as they went in, YCoCg ones are converted like any other
+			for (int i = 0; i < 4; i++)
+				palette[i] = blends[i].To565().Backing();
+		}
+		static inline void Write(uint8_t* row, int x, Pixel pixel) { ((uint16_t*)row)[x] = pixel; }
+		static inline void Fill(uint8_t* row, int x, int count, Pixel pixel) { std::fill_n((uint16_t*)row + x, count, pixel); }
+		static inline void WriteRow(const Kernels::KernelTable& kernels, uint8_t* row, int x, const Pixel palette[4], int rowBits) { kernels.ExpandRow16((uint16_t*)row + x, palette, rowBits); }
+	};
+}
@@ -4,17 +4,14 @@
 class RGB565Color
 {
 private:
-	union {
-		uint16_t _backing;
-		uint8_t _Low, _High; // Little endian is weird
-	};
+	uint16_t _backing;
 public:
 	inline uint8_t R() { return (uint8_t)((_backing & 0b1111100000000000) >> 8); }
 	inline uint8_t G() { return (uint8_t)((_backing & 0b0000011111100000) >> 3); }
 	inline uint8_t B() { return (uint8_t)((_backing & 0b0000000000011111) << 3); }
 	inline uint16_t Backing() { return _backing; }
-	inline uint8_t BackingHigh() { return _High; }
-	inline uint8_t BackingLow() { return _Low; }
+	inline uint8_t BackingHigh() { return (uint8_t)(_backing >> 8); }
+	inline uint8_t BackingLow() { return (uint8_t)(_backing & 0xFF); }
 
 	static const int
 		ColorDepthBits = 16, // Must be power of two -- do not change
@@ -43,8 +40,8 @@ public:
 
 	inline static RGB565Color CreateFromHighLow(uint8_t high, uint8_t low) {
 		RGB565Color color;
-		color._High = high;
-		color._Low = low;
+		//Shifts instead of a byte union, so it doesn't matter what endianness we're on
+		color._backing = (uint16_t)((high << 8) | low);
 		return color;
 	}
 
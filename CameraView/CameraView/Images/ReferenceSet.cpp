@@ -0,0 +1,46 @@
+#include "ReferenceSet.h"
+
+ReferenceSet::ReferenceSet(int width, int height, int recentFrames, int backgroundDelay) :
+	_StillFrames((width + Region::Width - 1) / Region::Width, (height + Region::Height - 1) / Region::Height)
+{
+	assert(recentFrames >= 0 && recentFrames + 1 <= MaxReferences);
+	assert(backgroundDelay > 0);
+	_RecentFrames = recentFrames;
+	_BackgroundDelay = backgroundDelay;
+	//One image per recent frame, plus the background
+	for (int i = 0; i < recentFrames + 1; i++)
+		_References.push_back(new CompressedImage(width, height));
+	_RowValid.resize(_StillFrames.Height(), 0);
+	_RegionLost.resize(_StillFrames.Count(), 0);
+}
+
+ReferenceSet::~ReferenceSet()
+{
+	for (auto image : _References)
+		delete image;
+}
+
+void ReferenceSet::ResetRow(CompressedImage & image, int y)
+{
+	for (int x = 0; x < image.RegionsWide(); x++) {
+		for (auto reference : _References)
+			reference->ShareRegion(x, y, image);
+		_StillFrames.Get(x, y) = 0;
+	}
+	_RowValid[y] = 1;
+}
+
+void ReferenceSet::Update(int x, int y, const RegionHandle & previous, const RegionHandle & current, bool unchanged)
+{
+	//Shift the recent frames along, dropping the oldest
+	for (int i = _RecentFrames - 1; i > 0; i--)
+		_References[i]->ShareRegion(x, y, *_References[i - 1]);
+	if (_RecentFrames > 0)
+		_References[0]->GetRegionHandle(x, y) = previous;
+
+	//Only copy to the background once, when the region has been still long enough
+	int& stillFrames = _StillFrames.Get(x, y);
+	stillFrames = unchanged ? stillFrames + 1 : 0;
+	if (stillFrames == _BackgroundDelay)
+		_References[_RecentFrames]->GetRegionHandle(x, y) = current;
+}
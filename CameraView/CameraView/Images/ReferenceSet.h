@@ -0,0 +1,61 @@
+#pragma once
+#include <vector>
+#include "CompressedImage.h"
+
+//The long-term references of a stream: the few frames before the previous one, and a background built up from the
+//regions which have stayed still for a while. A region which matches one of them can be copied from it instead of being
+//sent again -- e.g. the background revealed when something moves away.
+//
+//The encoder and the decoder keep their own sets, which must be created with the same settings. Both update them the
+//same way, a region at a time, from what's in the stream, so they never need to be sent. They're reset at every frame
+//which doesn't use them (keyframes, among others): the frame after one starts off with every reference a copy of it.
+class ReferenceSet
+{
+private:
+	int _RecentFrames;
+	int _BackgroundDelay;
+	//The recent frames, most recent first, then the background
+	std::vector<CompressedImage*> _References;
+	//How many frames in a row each region has been left as it was
+	Array2D<int> _StillFrames;
+	//Whether each row of regions is up to date (rows are updated independently of each other)
+	std::vector<char> _RowValid;
+	//Whether each region's references have fallen out of step with the encoder's, until the next keyframe
+	std::vector<char> _RegionLost;
+public:
+	//The most references a set can have (they're numbered with a byte in the stream)
+	static const int MaxReferences = 256;
+
+	//Keeps the recentFrames frames before the previous one, and copies regions to the background once they've been
+	//still for backgroundDelay frames
+	ReferenceSet(int width, int height, int recentFrames = 2, int backgroundDelay = 30);
+	~ReferenceSet();
+
+	//The number of references: the recent frames (0 is the one before the previous frame), then the background
+	inline int Count() { return (int)_References.size(); }
+	inline int BackgroundIndex() { return _RecentFrames; }
+	//The settings the set was created with, for creating a matching one (e.g. the decoder's from the encoder's)
+	inline int RecentFrames() { return _RecentFrames; }
+	inline int BackgroundDelay() { return _BackgroundDelay; }
+	inline Region& GetRegion(int reference, int x, int y) { return _References[reference]->GetRegion(x, y); }
+	inline RegionHandle& GetRegionHandle(int reference, int x, int y) { return _References[reference]->GetRegionHandle(x, y); }
+
+	//Whether a row of regions is up to date. If not, it needs to be reset from the previous frame before it is used.
+	inline bool RowValid(int y) { return _RowValid[y] != 0; }
+	//Makes every reference of a row a copy of the frame's
+	void ResetRow(CompressedImage& image, int y);
+	//Marks a row as out of date, for frames which don't use the references
+	inline void InvalidateRow(int y) { _RowValid[y] = 0; }
+	//Whether a region's references are out of step with the encoder's because the decoder missed one of its updates
+	//(e.g. in a lost packet). Each region's references only follow that region, so the rest are still good, but this
+	//one's can't be used until Reset() at the next keyframe.
+	inline bool RegionLost(int x, int y) { return _RegionLost[y * _StillFrames.Width() + x] != 0; }
+	inline void LoseRegion(int x, int y) { _RegionLost[y * _StillFrames.Width() + x] = 1; }
+	//Marks every row as out of date, and no region as lost, at a keyframe (which the encoder's set is reset at too)
+	inline void Reset() { _RowValid.assign(_RowValid.size(), 0); _RegionLost.assign(_RegionLost.size(), 0); }
+
+	//Moves a region on to the next frame: the previous frame's region becomes the most recent reference, and the
+	//region goes into the background if it has been left as it was (copied from the previous frame) long enough. The
+	//references share the regions rather than copying them.
+	void Update(int x, int y, const RegionHandle& previous, const RegionHandle& current, bool unchanged);
+};
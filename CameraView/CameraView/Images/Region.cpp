@@ -1,38 +1,244 @@
 #include "Region.h"
+#include <vector>
 
 
-Region::Region(BGRColor* blockColors)
+Region::Region(BGRAColor* blockColors, bool matchSimilarBlocks, bool adaptive, Block::ColorFormat colors)
 {
+	Build(blockColors, matchSimilarBlocks, adaptive, colors);
+}
+
+void Region::Build(BGRAColor * blockColors, bool matchSimilarBlocks, bool adaptive, Block::ColorFormat colors)
+{
+	//Whatever the region held before goes
+	for (int i = 0; i < BlockTableSizeBytes; i++)
+		BlockTable[i] = 0;
+	Mode = MODE_BLOCKS;
+	TemporalMask = 0;
+	PixelValues = 0;
+
 	//Construct the blocks
+	int errors[BlockCount];
 	for (int i = 0; i < BlockCount; i++) {
 		int arrayOffset = i * Block::PixelCount;
-		Blocks[i] = Block(blockColors + arrayOffset);
-		PixelValues += Blocks[i].GetTotalPixelValue();
+		Blocks[i] = Block(blockColors + arrayOffset, false, &errors[i], colors);
 	}
+	//Pick the block sizes
+	if (adaptive && !TryWhole(blockColors, colors))
+		SplitDetailedBlocks(blockColors, errors, colors);
+
+	SumPixelValues();
 	//And do similarity matching
-	MatchSimilarBlocks();
+	Region* self = this;
+	if (matchSimilarBlocks)
+		MatchSimilarBlocks(&self, 1);
+}
+
+bool Region::TryWhole(BGRAColor * blockColors, Block::ColorFormat colors)
+{
+	//The blocks' colors are a cheap stand in for the range of the region's pixels
+	BGRColor reference = Block::DecodeColor(Blocks[0].LowColor, colors);
+	for (int i = 0; i < BlockCount; i++) {
+		if (BGRColor::DistanceAbs(reference, Block::DecodeColor(Blocks[i].LowColor, colors)) > WholeRegionThreshold ||
+			BGRColor::DistanceAbs(reference, Block::DecodeColor(Blocks[i].HighColor, colors)) > WholeRegionThreshold)
+			return false;
+	}
+
+	//Average each 4x4 cell down to one pixel of the whole region block
+	BGRAColor cells[Block::PixelCount];
+	for (int cellY = 0; cellY < Block::Height; cellY++) {
+		for (int cellX = 0; cellX < Block::Width; cellX++) {
+			int cellsPerBlock = Block::Width / WholeCellSize;
+			BGRAColor* block = blockColors + ((cellY / cellsPerBlock) * BlocksPerRow + cellX / cellsPerBlock) * Block::PixelCount;
+			int left = (cellX % cellsPerBlock) * WholeCellSize, top = (cellY % cellsPerBlock) * WholeCellSize;
+			int r = 0, g = 0, b = 0;
+			for (int y = 0; y < WholeCellSize; y++)
+				for (int x = 0; x < WholeCellSize; x++) {
+					BGRAColor pixel = block[(top + y) * Block::Width + left + x];
+					r += pixel.R();
+					g += pixel.G();
+					b += pixel.B();
+				}
+			int count = WholeCellSize * WholeCellSize;
+			cells[cellY * Block::Width + cellX] = BGRAColor((uint8_t)(r / count), (uint8_t)(g / count), (uint8_t)(b / count));
+		}
+	}
+
+	Mode = MODE_WHOLE;
+	Block whole(cells, colors);
+	for (int i = 0; i < BlockCount; i++)
+		Blocks[i] = whole;
+	return true;
 }
 
-void Region::MatchSimilarBlocks()
+void Region::SplitDetailedBlocks(BGRAColor * blockColors, int * errors, Block::ColorFormat colors)
 {
+	for (int i = 0; i < BlockCount; i++) {
+		//Most blocks are well served by 2 colors -- don't bother trying the rest
+		if (errors[i] <= SplitErrorThreshold)
+			continue;
+
+		int splitError;
+		Block split(blockColors + i * Block::PixelCount, true, &splitError, colors);
+		if (errors[i] - splitError >= SplitGainThreshold)
+			Blocks[i] = split;
+	}
+}
+
+void Region::ReuseBlocks(Region & previous, uint16_t mask)
+{
+	TemporalMask = mask;
+	//Neighbors always come first, so one pass in order resolves chains of them
+	for (int i = 0; i < BlockCount; i++) {
+		if (mask & (1 << i)) {
+			Blocks[i] = previous.Blocks[i];
+			continue;
+		}
+		switch (BlockPresenceStatus(i % BlocksPerRow, i / BlocksPerRow)) {
+		case BLOCK_PRESENT: break;
+		case BLOCK_LEFT_REPRESENTS: Blocks[i] = Blocks[i - 1]; break;
+		case BLOCK_ABOVE_REPRESENTS: Blocks[i] = Blocks[i - BlocksPerRow]; break;
+		case BLOCK_ABOVE_LEFT_REPRESENTS: Blocks[i] = Blocks[i - 1 - BlocksPerRow]; break;
+		}
+	}
+
+	SumPixelValues();
+}
+
+void Region::SumPixelValues()
+{
+	PixelValues = 0;
+	YCoCgTotals = true;
+	for (int c = 0; c < 3; c++)
+		YCoCgValues[c] = 0;
+	for (int i = 0; i < BlockCount; i++) {
+		PixelValues += Blocks[i].GetTotalPixelValue();
+		YCoCgTotals = YCoCgTotals && Blocks[i].Colors == Block::COLORS_YCOCG;
+		for (int c = 0; c < 3; c++)
+			YCoCgValues[c] += Blocks[i].GetTotalYCoCgValue(c);
+	}
+}
+
+int Region::DifferenceFactor(Region & me, Region & other)
+{
+	if (!me.YCoCgTotals || !other.YCoCgTotals)
+		return abs(other.PixelValues - me.PixelValues);
+	return Block::WeighDifference(abs(other.YCoCgValues[0] - me.YCoCgValues[0]), abs(other.YCoCgValues[1] - me.YCoCgValues[1]), abs(other.YCoCgValues[2] - me.YCoCgValues[2]));
+}
+
+bool Region::BlockTableValid(const uint8_t * blockTable)
+{
+	//The neighbors are counted in block order, the same as MatchSimilarBlocks() picks them: the block left of the first
+	//in a row is the last of the row above
+	for (int i = 0; i < BlockCount; i++) {
+		BlockPresence presence = (BlockPresence)((blockTable[i / 4] >> ((i % 4) * 2)) & 0b00000011);
+		int neighbor = presence == BLOCK_LEFT_REPRESENTS ? i - 1 : presence == BLOCK_ABOVE_REPRESENTS ? i - BlocksPerRow :
+			presence == BLOCK_ABOVE_LEFT_REPRESENTS ? i - 1 - BlocksPerRow : i;
+		if (neighbor < 0)
+			return false;
+	}
+	return true;
+}
+
+uint16_t Region::SolidMask()
+{
+	uint16_t mask = 0;
+	for (int i = 0; i < BlockCount; i++)
+		if (Blocks[i].IsSolid())
+			mask |= 1 << i;
+	return mask;
+}
+
+int Region::SolidSavingsBytes()
+{
+	if (Mode != MODE_BLOCKS)
+		return 0;
+	int savings = -SolidMaskSizeBytes;
+	for (int i = 0; i < BlockCount; i++) {
+		if (BlockPresenceStatus(i % BlocksPerRow, i / BlocksPerRow) == BLOCK_PRESENT && !(TemporalMask & (1 << i)) && Blocks[i].IsSolid())
+			savings += Block::SizeBytes - Block::SolidSizeBytes;
+	}
+	return savings;
+}
+
+int Region::EncodedSizeBytes(bool adaptive, bool temporalBlocks, bool solidBlocks)
+{
+	if (!adaptive || Mode == MODE_BLOCKS) {
+		int size = adaptive ? 1 + BlockTableSizeBytes + SplitMaskSizeBytes : BlockTableSizeBytes;
+		if (temporalBlocks)
+			size += TemporalMaskSizeBytes;
+		if (solidBlocks)
+			size += SolidMaskSizeBytes;
+		for (int i = 0; i < BlockCount; i++) {
+			if (BlockPresenceStatus(i % BlocksPerRow, i / BlocksPerRow) == BLOCK_PRESENT && !(TemporalMask & (1 << i)))
+				size += solidBlocks && Blocks[i].IsSolid() ? Block::SolidSizeBytes : Blocks[i].Split ? Block::SplitSizeBytes : Block::SizeBytes;
+		}
+		return size;
+	}
+	//The mode and the whole region block
+	return 1 + Block::SizeBytes;
+}
+
+void Region::MatchSimilarBlocks(Region ** regions, int count)
+{
+	//Compare every block with its neighbors first...
+	std::vector<uint8_t> similarNeighbors(count * BlockCount);
+	for (int r = 0; r < count; r++)
+		regions[r]->CompareNeighbors(&similarNeighbors[r * BlockCount]);
+	//...then make the (order dependent) choices
+	for (int r = 0; r < count; r++)
+		regions[r]->MatchSimilarBlocks(&similarNeighbors[r * BlockCount]);
+}
+
+void Region::CompareNeighbors(uint8_t * similarNeighbors)
+{
+	similarNeighbors[0] = 0;
+	//Whole regions have only one block to begin with
+	if (Mode == MODE_WHOLE)
+		return;
+	for (int i = 1; i < BlockCount; i++) {
+		uint8_t mask = 0;
+		if (Block::SimilarTo(Blocks[i], Blocks[i - 1], SimilarBlockPixelThreshold, SimilarBlockTotalThreshold))
+			mask |= NEIGHBOR_LEFT;
+		if (i - BlocksPerRow > 0 && Block::SimilarTo(Blocks[i], Blocks[i - BlocksPerRow], SimilarBlockPixelThreshold, SimilarBlockTotalThreshold))
+			mask |= NEIGHBOR_ABOVE;
+		if (i - 1 - BlocksPerRow > 0 && Block::SimilarTo(Blocks[i], Blocks[i - 1 - BlocksPerRow], SimilarBlockPixelThreshold, SimilarBlockTotalThreshold))
+			mask |= NEIGHBOR_ABOVE_LEFT;
+		similarNeighbors[i] = mask;
+	}
+}
+
+void Region::MatchSimilarBlocks(const uint8_t * similarNeighbors)
+{
+	if (Mode == MODE_WHOLE)
+		return;
+	//A block which was replaced by its neighbor no longer looks like it did when it was compared, so comparisons
+	//against it are redone
+	bool replaced[BlockCount] = {};
+	auto similar = [&](int i, int neighbor, NeighborMask bit) {
+		if (replaced[neighbor])
+			return Block::SimilarTo(Blocks[i], Blocks[neighbor], SimilarBlockPixelThreshold, SimilarBlockTotalThreshold);
+		return (similarNeighbors[i] & bit) != 0;
+	};
+
 	//The first block must always be present
 	for (int i = 1; i < BlockCount; i++) {
 		BlockPresence presence = BLOCK_PRESENT;
 		//Compare with block to left
-		if (Block::SimilarTo(Blocks[i], Blocks[i - 1], SimilarBlockPixelThreshold, SimilarBlockTotalThreshold)) {
+		if (similar(i, i - 1, NEIGHBOR_LEFT)) {
 			presence = BLOCK_LEFT_REPRESENTS;
 			Blocks[i] = Blocks[i - 1];
 		}
 		//Compare with block above -- assuming this isn't in the first row
-		else if (i - BlocksPerRow > 0 && Block::SimilarTo(Blocks[i], Blocks[i - BlocksPerRow], SimilarBlockPixelThreshold, SimilarBlockTotalThreshold)) {
+		else if (i - BlocksPerRow > 0 && similar(i, i - BlocksPerRow, NEIGHBOR_ABOVE)) {
 			presence = BLOCK_ABOVE_REPRESENTS;
 			Blocks[i] = Blocks[i - BlocksPerRow];
 		}
 		//Compare with block above and to the left -- assuming this isn't in the first row
-		else if (i - 1 - BlocksPerRow > 0 && Block::SimilarTo(Blocks[i],Blocks[i - 1 - BlocksPerRow], SimilarBlockPixelThreshold, SimilarBlockTotalThreshold)) {
+		else if (i - 1 - BlocksPerRow > 0 && similar(i, i - 1 - BlocksPerRow, NEIGHBOR_ABOVE_LEFT)) {
 			presence = BLOCK_ABOVE_LEFT_REPRESENTS;
 			Blocks[i] = Blocks[i - 1 - BlocksPerRow];
 		}
+		replaced[i] = presence != BLOCK_PRESENT;
 
 		//And write the result to block presence table
 		int byteOffset = i / 4;
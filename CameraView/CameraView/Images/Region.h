@@ -7,9 +7,21 @@ class Region
 {
 private:
 	//Pixel values of all the blocks in this region
-	int PixelValues;
-	//Find blocks which are similar to one another and marks them as identical
-	void MatchSimilarBlocks();
+	int PixelValues = 0;
+	//And their YCoCg totals, if every block is YCoCg
+	int YCoCgValues[3] = {};
+	bool YCoCgTotals = false;
+	//Adds up the totals of the blocks
+	void SumPixelValues();
+	//Find blocks which are similar to one another and marks them as identical, given which blocks were found to be
+	//similar to their (unmatched) neighbors
+	void MatchSimilarBlocks(const uint8_t* similarNeighbors);
+	//Which neighbors each block of the region is similar to, as a NEIGHBOR_* mask per block
+	void CompareNeighbors(uint8_t* similarNeighbors);
+	//Codes the region as one whole block if it's flat enough. Returns whether it did.
+	bool TryWhole(BGRAColor* blockColors, Block::ColorFormat colors);
+	//Splits the blocks which are too detailed for 2 colors, given how far off each block is
+	void SplitDetailedBlocks(BGRAColor* blockColors, int* errors, Block::ColorFormat colors);
 public:
 	//Defines whether a block is present in the stream, and if not, what block represents it
 	enum BlockPresence {
@@ -23,6 +35,22 @@ public:
 		BLOCK_ABOVE_LEFT_REPRESENTS
 	};
 
+	//How a region is coded in adaptive frames
+	enum RegionMode {
+		//4x4 blocks of 8x8 pixels, as usual. Each present block may be split into 4x4 pixel quarters.
+		MODE_BLOCKS,
+		//A single two color block stretched over the whole region: each of its 8x8 pixels is a 4x4 pixel cell.
+		//For flat areas, where even one block per region plus the block table is more than they need.
+		MODE_WHOLE
+	};
+
+	//The neighbors a block was found similar to, before any blocks were matched
+	enum NeighborMask {
+		NEIGHBOR_LEFT = 1,
+		NEIGHBOR_ABOVE = 2,
+		NEIGHBOR_ABOVE_LEFT = 4
+	};
+
 	static const int
 		Width = Block::Width * 4,
 		Height = Block::Height * 4,
@@ -34,18 +62,47 @@ public:
 		SizeBits = BlockTableSizeBits + Block::SizeBits * BlockCount, //128 bit block table + blocks
 		SizeBytes = SizeBits / 8,
 		SimilarBlockPixelThreshold = 24,
-		SimilarBlockTotalThreshold = 128; //To be tuned as needed
+		SimilarBlockTotalThreshold = 128, //To be tuned as needed
+		//Adaptive frames: a mode byte, then either the whole region block or the block table, a 16 bit split mask and the blocks
+		WholeCellSize = Width / Block::Width,
+		SplitMaskSizeBytes = BlockCount / 8,
+		TemporalMaskSizeBytes = BlockCount / 8,
+		SolidMaskSizeBytes = BlockCount / 8,
+		AdaptiveSizeBytes = 1 + BlockTableSizeBytes + SplitMaskSizeBytes + BlockCount * Block::SplitSizeBytes,
+		//The most the temporal mask adds to a region
+		TemporalSizeBytes = TemporalMaskSizeBytes,
+		//And the solid mask (solid blocks only ever make a region smaller)
+		SolidSizeBytes = SolidMaskSizeBytes,
+		//A region is coded whole if every block's colors are within this distance of the first block's low color
+		WholeRegionThreshold = 36,
+		//A block is considered for splitting if its pixels are off by more than this on average (summed over the channels)...
+		SplitErrorThreshold = 24 * Block::PixelCount,
+		//...and split if that takes this much off
+		SplitGainThreshold = 8 * Block::PixelCount;
 
 	//The block presence table. Explains whether any block can be represented by its neighbors via BlockPresence enum
 	uint8_t BlockTable[BlockTableSizeBytes] = {};
 	Block Blocks[BlockCount] = {};
+	//Always MODE_BLOCKS unless the image is adaptive. In MODE_WHOLE, every one of the blocks is the whole region block.
+	RegionMode Mode = MODE_BLOCKS;
+	//The blocks which are the same as in the previous frame and left out of the stream: bit N for block N
+	uint16_t TemporalMask = 0;
 
 	Region() {}
 	//Creates a region from a set of colors. It is expected they are 
 	//aligned as 4x4 blocks written in row order -- aka as such:
 	//So: (0,0) (1,0) (2,0) (3,0) (0,1) (1,1) (2,1) (3,1)...
-	Region(BGRColor* blockColors);
+	//Similar blocks are matched unless told not to, in which case MatchSimilarBlocks() must be called on it.
+	//Adaptive regions pick their block sizes to suit the content (see RegionMode). The blocks' colors are stored in the
+	//given format.
+	Region(BGRAColor* blockColors, bool matchSimilarBlocks = true, bool adaptive = false, Block::ColorFormat colors = Block::COLORS_RGB565);
 	~Region();
+	//Builds the region in place from a set of colors, the same as the constructor, replacing whatever it held
+	void Build(BGRAColor* blockColors, bool matchSimilarBlocks = true, bool adaptive = false, Block::ColorFormat colors = Block::COLORS_RGB565);
+
+	//Matches similar blocks in a run of regions (e.g. a row of them). The block comparisons of all the regions are
+	//done in one pass first, which keeps the comparison loop tight.
+	static void MatchSimilarBlocks(Region** regions, int count);
 
 	inline BlockPresence BlockPresenceStatus(int x, int y) {
 		int i = y * BlocksPerRow + x;
@@ -59,9 +116,33 @@ public:
 	}
 	//Returns whether a block is represented by one of its neighbors
 	inline bool IsBlockPresent(int x, int y) { return BlockPresenceStatus(x, y) == BLOCK_PRESENT; }
+	//Returns whether every block of a block table is represented by a block in the region. One read off the wire could
+	//name a neighbor before the first block.
+	static bool BlockTableValid(const uint8_t* blockTable);
 
 	inline Block& GetBlock(int x, int y) { return Blocks[y * BlocksPerRow + x]; }
 
+	//Returns the added-together pixel values of all the blocks, as built. Used for cheap comparisons.
+	inline int GetTotalPixelValue() { return PixelValues; }
+	//Gets how far apart the totals of two regions are, weighed the same way as Block::DifferenceFactor(). It's never
+	//more than the sum of their blocks' difference factors.
+	static int DifferenceFactor(Region& me, Region& other);
+
+	//Whether the block is unchanged from the previous frame (and not in the stream)
+	inline bool IsBlockTemporal(int x, int y) { return (TemporalMask & (1 << (y * BlocksPerRow + x))) != 0; }
+	//Takes the blocks in the mask from the previous frame's region, and has their neighbors follow suit -- the blocks
+	//represented by them are copied again -- so the region is exactly what the decoder will have
+	void ReuseBlocks(Region& previous, uint16_t mask);
+
+	//The blocks which are one color all over (see Block::IsSolid()): bit N for block N
+	uint16_t SolidMask();
+	//How many bytes smaller coding the region's solid blocks in just their color makes it, less the mask that takes.
+	//Negative if there are too few of them to pay for it.
+	int SolidSavingsBytes();
+
+	//The number of bytes the region takes up once serialized
+	int EncodedSizeBytes(bool adaptive, bool temporalBlocks, bool solidBlocks);
+
 	//Compares this region with another to tell if the two are similar
 	bool SimilarTo(Region& region, int similarityThresholdTotal, int similarityThresholdPerBlock);
 };
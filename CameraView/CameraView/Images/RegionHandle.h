@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include "Region.h"
+
+//A reference counted handle to a region. Images (and long-term references) which have a region in common -- e.g. one
+//reused from the previous frame -- share it, so reusing a region is a pointer copy rather than a copy of its blocks.
+//
+//Copy on write: a region is only changed through Edit() or Replace(), which give the handle a region of its own first
+//if it's shared. A handle can't be used from two threads at once, but handles sharing a region can.
+class RegionHandle
+{
+private:
+	struct Shared {
+		std::atomic<int> References;
+		Region Value;
+		Shared() : References(1) {}
+		Shared(const Region& value) : References(1), Value(value) {}
+	};
+	Shared* _Shared;
+
+	inline void Release() {
+		if (_Shared->References.fetch_sub(1) == 1)
+			delete _Shared;
+	}
+public:
+	RegionHandle() : _Shared(new Shared()) {}
+	RegionHandle(const RegionHandle& other) : _Shared(other._Shared) { _Shared->References++; }
+	~RegionHandle() { Release(); }
+	RegionHandle& operator=(const RegionHandle& other) {
+		//Taken first, in case they're the same region
+		other._Shared->References++;
+		Release();
+		_Shared = other._Shared;
+		return *this;
+	}
+
+	//Whether another handle has the region too
+	inline bool IsShared() const { return _Shared->References.load() > 1; }
+	inline bool SharesWith(const RegionHandle& other) const { return _Shared == other._Shared; }
+	//The region, for reading. It mustn't be changed through this while it's shared.
+	inline Region& Get() const { return _Shared->Value; }
+	//The region, for changing: copied first if it's shared
+	inline Region& Edit() {
+		if (IsShared()) {
+			Shared* copy = new Shared(_Shared->Value);
+			Release();
+			_Shared = copy;
+		}
+		return _Shared->Value;
+	}
+	//The region, for setting from scratch: if it's shared, a new one rather than a copy. Its contents are undefined.
+	inline Region& Replace() {
+		if (IsShared()) {
+			Shared* fresh = new Shared();
+			Release();
+			_Shared = fresh;
+		}
+		return _Shared->Value;
+	}
+};
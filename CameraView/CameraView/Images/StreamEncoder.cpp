@@ -0,0 +1,441 @@
+#include "StreamEncoder.h"
+#include "Encoder.h"
+#include <climits>
+#include <cassert>
+#include <cstdlib>
+#include <algorithm>
+
+StreamEncoder::StreamEncoder(int width, int height, int similarityThreshold, int maxFramesInFlight, int recentReferences, int backgroundDelay) :
+	_References(width, height, recentReferences, backgroundDelay)
+{
+	assert(maxFramesInFlight > 0);
+	_SimilarityThreshold = similarityThreshold;
+	_SceneKeyframe = false;
+	_DeadlineMisses = 0;
+	_DegradedFrames = 0;
+	for (int i = 0; i < maxFramesInFlight + 1; i++) {
+		FrameSlot slot;
+		slot.Image = new CompressedImage(width, height);
+		slot.Differences = new ImageDiff(slot.Image->RegionsWide(), slot.Image->RegionsTall(), similarityThreshold);
+		slot.IsKeyframe = false;
+		slot.RefreshColumn = -1;
+		slot.RowCuts.resize(slot.Image->RegionsTall(), 0);
+		slot.IsSceneChange = false;
+		slot.HasDeadline = false;
+		slot.RowsStarted = 0;
+		slot.RowTiers.resize(slot.Image->RegionsTall(), TIER_FULL);
+		slot.RowUnchanged.resize(slot.Image->RegionsTall(), 0);
+		slot.RowSolidSavings.resize(slot.Image->RegionsTall(), 0);
+		slot.MissedDeadline = false;
+		_Slots.push_back(slot);
+	}
+}
+
+StreamEncoder::~StreamEncoder()
+{
+	for (auto& slot : _Slots) {
+		delete slot.Image;
+		delete slot.Differences;
+	}
+}
+
+std::vector<uint8_t> StreamEncoder::EncodeFrame(const InputFrame & frame)
+{
+	std::vector<uint8_t> serialized(MaxEncodedSize());
+	serialized.resize(EncodeFrame(frame, serialized.data()));
+	return serialized;
+}
+
+int StreamEncoder::EncodeFrame(const InputFrame & frame, uint8_t * output)
+{
+	int frameNumber = _FrameBudget > Scheduler::Clock::duration::zero() ? BeginFrame(Scheduler::Clock::now() + _FrameBudget) : BeginFrame();
+
+	std::vector<std::future<void>> futures;
+	for (int y = 0; y < RegionsTall(); y++)
+		futures.push_back(CompressedImage::Pool().Enqueue([this, frameNumber, &frame, y] { EncodeRegionRow(frameNumber, frame, y); }));
+
+	for (size_t i = 0; i < futures.size(); i++)
+		futures[i].wait();
+
+	return FinishFrame(frameNumber, output);
+}
+
+int StreamEncoder::MaxEncodedSize()
+{
+	//Sized for the frame about to be begun
+	return Encoder::MaxEncodedSize(_Slots[0].Image->RegionsWide() * RegionsTall(), _Adaptive, _TemporalBlockSkip, _LongTermReferences, _SolidBlocks);
+}
+
+int StreamEncoder::BeginFrame()
+{
+	int frameNumber = BeginFrame(Scheduler::TimePoint::max());
+	Slot(frameNumber).HasDeadline = false;
+	return frameNumber;
+}
+
+int StreamEncoder::BeginFrame(Scheduler::TimePoint deadline)
+{
+	int frameNumber = _NextFrame++;
+	assert(frameNumber - _LastFinished <= MaxFramesInFlight() /*Too many frames in flight*/);
+	FrameSlot& slot = Slot(frameNumber);
+	//Regions coded one way can't be reused in frames coded the other
+	if (frameNumber > 0 && (Slot(frameNumber - 1).Image->Adaptive() != _Adaptive || Slot(frameNumber - 1).Image->YCoCgColors() != _YCoCgColors))
+		_KeyframeRequested = true;
+	slot.Image->Adaptive() = _Adaptive;
+	slot.Image->YCoCgColors() = _YCoCgColors;
+
+	//A scene change sent as a keyframe restarts the keyframe interval, the same as any other keyframe
+	if (_SceneKeyframe.exchange(false))
+		_FramesSinceKeyframe = 0;
+
+	//Decide the frame's type up front -- the rows are encoded concurrently
+	slot.IsKeyframe = frameNumber == 0 || _KeyframeRequested || (_KeyframeInterval > 0 && _FramesSinceKeyframe >= _KeyframeInterval);
+	if (slot.IsKeyframe) {
+		_KeyframeRequested = false;
+		_FramesSinceKeyframe = 0;
+		//A keyframe refreshes everything, so restart the sweep
+		_RefreshColumn = -1;
+	}
+	else if (_IntraRefresh)
+		_RefreshColumn = (_RefreshColumn + 1) % slot.Image->RegionsWide();
+	else
+		_RefreshColumn = -1;
+	_FramesSinceKeyframe++;
+
+	//Keyframes can't refer to the previous frame at all
+	slot.Image->TemporalBlocks() = _TemporalBlockSkip && !slot.IsKeyframe;
+	slot.Image->References() = _LongTermReferences && !slot.IsKeyframe;
+	slot.RefreshColumn = _RefreshColumn;
+	slot.IsSceneChange = false;
+	for (size_t i = 0; i < slot.RowCuts.size(); i++)
+		slot.RowCuts[i] = 0;
+	slot.HasDeadline = true;
+	slot.Deadline = deadline;
+	slot.RowsStarted = 0;
+	slot.MissedDeadline = false;
+	slot.Differences->SimilarityThreshold() = _SimilarityThreshold;
+	assert(_RegionThresholds.empty() || (int)_RegionThresholds.size() == slot.Image->RegionsWide() * RegionsTall());
+	slot.Thresholds = _RegionThresholds;
+	return frameNumber;
+}
+
+void StreamEncoder::EncodeRegionRow(int frameNumber, const InputFrame & frame, int regionY)
+{
+	FrameSlot& slot = Slot(frameNumber);
+	auto started = Scheduler::Clock::now();
+	QualityTier tier;
+	{
+		std::lock_guard<std::mutex> lock(_TierMutex);
+		tier = ChooseTier(slot, started);
+	}
+	slot.RowTiers[regionY] = (uint8_t)tier;
+	if (tier == TIER_SKIP) {
+		SkipRegionRow(slot, frameNumber, frame, regionY);
+		TallySolidSavings(slot, regionY);
+		return;
+	}
+	EncodeRegionRow(slot, frameNumber, frame, regionY, tier);
+	TallySolidSavings(slot, regionY);
+
+	//Keep track of how long rows take at the tier
+	double secs = std::chrono::duration<double>(Scheduler::Clock::now() - started).count();
+	std::lock_guard<std::mutex> lock(_TierMutex);
+	_RowSecs[tier] = _RowSecs[tier] == 0 ? secs : _RowSecs[tier] * 0.9 + secs * 0.1;
+}
+
+void StreamEncoder::EncodeRegionRow(int frameNumber, CompressedImage & built, int regionY)
+{
+	FrameSlot& slot = Slot(frameNumber);
+	assert(built.Adaptive() == slot.Image->Adaptive() /*Built with other block sizes than the frame's*/);
+	assert(built.YCoCgColors() == slot.Image->YCoCgColors() /*Built with other colors than the frame's*/);
+	slot.RowsStarted++;
+	slot.RowTiers[regionY] = TIER_FULL;
+	CompressedImage* current = slot.Image;
+	CompressedImage* previous = Slot(frameNumber - 1).Image;
+	//The same regions are copied from the previous frame as SetRegionRowData() would have
+	bool skipUnchanged = _SkipUnchangedRegions && !slot.IsKeyframe;
+	int unchanged = 0;
+	for (int x = 0; x < current->RegionsWide(); x++) {
+		current->PixelHash(x, regionY) = built.PixelHash(x, regionY);
+		if (skipUnchanged && x != slot.RefreshColumn && previous->PixelHash(x, regionY) == built.PixelHash(x, regionY)) {
+			current->ShareRegion(x, regionY, *previous);
+			unchanged++;
+		}
+		else
+			current->ShareRegion(x, regionY, built);
+	}
+	slot.RowUnchanged[regionY] = unchanged;
+	ResolveRegionRow(slot, frameNumber, regionY, TIER_FULL);
+	TallySolidSavings(slot, regionY);
+}
+
+void StreamEncoder::TallySolidSavings(FrameSlot & slot, int regionY)
+{
+	//Tally up what the row's solid blocks would save, while it's fresh
+	int solidSavings = 0;
+	if (_SolidBlocks)
+		for (int x = 0; x < slot.Image->RegionsWide(); x++)
+			if (slot.Differences->IsPresent(x, regionY))
+				solidSavings += slot.Image->GetRegion(x, regionY).SolidSavingsBytes();
+	slot.RowSolidSavings[regionY] = solidSavings;
+}
+
+StreamEncoder::QualityTier StreamEncoder::ChooseTier(FrameSlot & slot, Scheduler::TimePoint now)
+{
+	int rowsLeft = RegionsTall() - slot.RowsStarted++;
+	if (!_HoldDeadlines || !slot.HasDeadline)
+		return TIER_FULL;
+
+	//The time each of the rows left can take, with as many of them going at once as there are threads for, leaving
+	//enough to serialize the frame
+	double secsLeft = std::chrono::duration<double>(slot.Deadline - now).count() - _FinishSecs;
+	int parallelRows = std::min(rowsLeft, CompressedImage::Pool().ThreadCount());
+	double rowSecs = secsLeft * parallelRows / rowsLeft;
+	//The best tier which fits. One which hasn't been measured yet is given a try, unless the frame is already late.
+	for (int tier = TIER_FULL; tier < TIER_SKIP; tier++)
+		if (_RowSecs[tier] <= rowSecs)
+			return (QualityTier)tier;
+	//Keyframe rows can't be skipped: there's nothing to reuse
+	return slot.IsKeyframe ? TIER_FAST : TIER_SKIP;
+}
+
+void StreamEncoder::SkipRegionRow(FrameSlot & slot, int frameNumber, const InputFrame & frame, int regionY)
+{
+	CompressedImage* current = slot.Image;
+	CompressedImage* previous = Slot(frameNumber - 1).Image;
+	slot.RowCuts[regionY] = 0;
+	slot.RowUnchanged[regionY] = 0;
+	for (int x = 0; x < current->RegionsWide(); x++) {
+		current->ShareRegion(x, regionY, *previous);
+		//The row holds what the previous frame's was set from
+		current->PixelHash(x, regionY) = previous->PixelHash(x, regionY);
+		//Similar under any threshold, so it's left out
+		slot.Differences->RegionDifference(x, regionY) = INT_MIN;
+		slot.Differences->RegionReference(x, regionY) = ImageDiff::NoReference;
+	}
+	//Except the region being refreshed, which would otherwise miss its turn for a whole sweep. It's built as the fast
+	//tier would.
+	if (slot.RefreshColumn >= 0) {
+		current->SetRegionData(frame, slot.RefreshColumn, regionY, false);
+		slot.Differences->RegionDifference(slot.RefreshColumn, regionY) = INT_MAX;
+	}
+	//The references see the rest of the row as unchanged, the same as the decoder will
+	if (current->References())
+		MatchReferences(slot, *previous, slot.RefreshColumn, false, regionY);
+	else
+		_References.InvalidateRow(regionY);
+}
+
+int StreamEncoder::UnchangedRegions()
+{
+	FrameSlot& slot = LastFinished();
+	int regions = 0;
+	for (size_t i = 0; i < slot.RowUnchanged.size(); i++)
+		regions += slot.RowUnchanged[i];
+	return regions;
+}
+
+int StreamEncoder::RowsAtTier(QualityTier tier)
+{
+	FrameSlot& slot = LastFinished();
+	int rows = 0;
+	for (size_t i = 0; i < slot.RowTiers.size(); i++)
+		if (slot.RowTiers[i] == tier)
+			rows++;
+	return rows;
+}
+
+void StreamEncoder::EncodeRegionRow(FrameSlot & slot, int frameNumber, const InputFrame & frame, int regionY, QualityTier tier)
+{
+	CompressedImage* current = slot.Image;
+	//The fast tier doesn't pick block sizes. Keyframes are built from scratch, so they undo any drift.
+	if (_SkipUnchangedRegions && !slot.IsKeyframe)
+		slot.RowUnchanged[regionY] = current->SetRegionRowData(frame, regionY, tier == TIER_FULL, *Slot(frameNumber - 1).Image, slot.RefreshColumn);
+	else {
+		current->SetRegionRowData(frame, regionY, tier == TIER_FULL);
+		slot.RowUnchanged[regionY] = 0;
+	}
+	ResolveRegionRow(slot, frameNumber, regionY, tier);
+}
+
+void StreamEncoder::ResolveRegionRow(FrameSlot & slot, int frameNumber, int regionY, QualityTier tier)
+{
+	CompressedImage* current = slot.Image;
+	ImageDiff* differences = slot.Differences;
+	if (slot.IsKeyframe) {
+		//Nothing to compare against (or we don't want to): every region is sent
+		for (int x = 0; x < current->RegionsWide(); x++) {
+			differences->RegionDifference(x, regionY) = INT_MAX;
+			differences->RegionReference(x, regionY) = ImageDiff::NoReference;
+		}
+		_References.InvalidateRow(regionY);
+		return;
+	}
+
+	//A row which changed too much to bother comparing (a cut, the lights going on) is sent whole
+	CompressedImage* previous = Slot(frameNumber - 1).Image;
+	bool cut = _SceneChangeDetection && IsSceneChangeRow(*previous, *current, regionY);
+	slot.RowCuts[regionY] = cut;
+	if (cut) {
+		for (int x = 0; x < current->RegionsWide(); x++) {
+			differences->RegionDifference(x, regionY) = INT_MAX;
+			differences->RegionReference(x, regionY) = ImageDiff::NoReference;
+		}
+	}
+	else {
+		//Run a comparison
+		differences->DiffRow(*previous, *current, regionY);
+		if (!slot.Thresholds.empty())
+			ApplyRegionThresholds(slot, regionY);
+		//The column being refreshed is sent no matter what
+		if (slot.RefreshColumn >= 0)
+			differences->RegionDifference(slot.RefreshColumn, regionY) = INT_MAX;
+		//And copy all the regions from the old image which are close enough
+		for (int x = 0; x < current->RegionsWide(); x++)
+			if (differences->AreSimilar(x, regionY))
+				current->ShareRegion(x, regionY, *previous);
+	}
+
+	//The references move on with every frame which uses them, cut or not
+	if (current->References())
+		MatchReferences(slot, *previous, slot.RefreshColumn, !cut && tier == TIER_FULL, regionY);
+	else
+		_References.InvalidateRow(regionY);
+
+	//Then, in the regions which are sent, the blocks which are close enough (the refreshed column is sent in full)
+	if (!current->TemporalBlocks() || cut || tier != TIER_FULL)
+		return;
+	for (int x = 0; x < current->RegionsWide(); x++) {
+		if (!differences->IsPresent(x, regionY) || x == slot.RefreshColumn)
+			continue;
+		Region& cRegion = current->GetRegion(x, regionY);
+		Region& pRegion = previous->GetRegion(x, regionY);
+		if (cRegion.Mode != Region::MODE_BLOCKS || pRegion.Mode != Region::MODE_BLOCKS)
+			continue;
+
+		int threshold = RegionThreshold(slot, x, regionY);
+		uint16_t mask = 0;
+		for (int i = 0; i < Region::BlockCount; i++) {
+			if (cRegion.BlockPresenceStatus(i % Region::BlocksPerRow, i / Region::BlocksPerRow) == Region::BLOCK_PRESENT &&
+				Block::DifferenceFactor(pRegion.Blocks[i], cRegion.Blocks[i]) < threshold)
+				mask |= 1 << i;
+		}
+		if (mask != 0)
+			current->EditRegion(x, regionY).ReuseBlocks(pRegion, mask);
+	}
+}
+
+void StreamEncoder::ApplyRegionThresholds(FrameSlot & slot, int regionY)
+{
+	//A difference is under its region's threshold exactly when, scaled by SimilarityThreshold() / threshold, it's
+	//under SimilarityThreshold()
+	for (int x = 0; x < slot.Image->RegionsWide(); x++) {
+		int threshold = RegionThreshold(slot, x, regionY);
+		int& difference = slot.Differences->RegionDifference(x, regionY);
+		if (threshold <= 0)
+			difference = INT_MAX;
+		else if (threshold != _SimilarityThreshold)
+			difference = (int)std::min<int64_t>(INT_MAX, (int64_t)difference * _SimilarityThreshold / threshold);
+	}
+}
+
+bool StreamEncoder::IsSceneChangeRow(CompressedImage & previous, CompressedImage & current, int regionY)
+{
+	//The totals of a region are off by at most the sum of its blocks' differences (weighed the same way), so a region
+	//whose totals are off by more than every block being at the threshold has at least one block over it
+	if (_SimilarityThreshold <= 0)
+		return false;
+	int changed = 0;
+	for (int x = 0; x < current.RegionsWide(); x++) {
+		int difference = Region::DifferenceFactor(current.GetRegion(x, regionY), previous.GetRegion(x, regionY));
+		if (difference >= Region::BlockCount * _SimilarityThreshold)
+			changed++;
+	}
+	//Three quarters of the row
+	return changed * 4 >= current.RegionsWide() * 3;
+}
+
+void StreamEncoder::MatchReferences(FrameSlot & slot, CompressedImage & previous, int refreshColumn, bool match, int regionY)
+{
+	CompressedImage& current = *slot.Image;
+	ImageDiff& differences = *slot.Differences;
+	//Catch up from the frame before, if it didn't use the references
+	if (!_References.RowValid(regionY))
+		_References.ResetRow(previous, regionY);
+
+	for (int x = 0; x < current.RegionsWide(); x++) {
+		RegionHandle& region = current.GetRegionHandle(x, regionY);
+		//Copy (share) the changed regions from the reference closest to them, if any is close enough
+		if (match && !differences.AreSimilar(x, regionY) && x != refreshColumn) {
+			int bestReference = ImageDiff::NoReference;
+			int bestDifference = RegionThreshold(slot, x, regionY);
+			for (int i = 0; i < _References.Count(); i++) {
+				int difference = ImageDiff::Compare(_References.GetRegion(i, x, regionY), region.Get());
+				if (difference < bestDifference) {
+					bestReference = i;
+					bestDifference = difference;
+				}
+			}
+			differences.RegionReference(x, regionY) = bestReference;
+			if (bestReference != ImageDiff::NoReference)
+				region = _References.GetRegionHandle(bestReference, x, regionY);
+		}
+		//And move the references on, the same way the decoder will
+		_References.Update(x, regionY, previous.GetRegionHandle(x, regionY), region, differences.AreSimilar(x, regionY));
+	}
+}
+
+std::vector<uint8_t> StreamEncoder::FinishFrame(int frameNumber)
+{
+	std::vector<uint8_t> serialized(MaxEncodedSize());
+	serialized.resize(FinishFrame(frameNumber, serialized.data()));
+	return serialized;
+}
+
+int StreamEncoder::FinishFrame(int frameNumber, uint8_t * output)
+{
+	assert(frameNumber == _LastFinished + 1 /*Frames must be finished in order*/);
+	FrameSlot& slot = Slot(frameNumber);
+	auto started = Scheduler::Clock::now();
+	if (!slot.IsKeyframe) {
+		int cutRows = 0;
+		for (size_t i = 0; i < slot.RowCuts.size(); i++)
+			cutRows += slot.RowCuts[i];
+		//Most of the picture changed at once
+		if (cutRows * 4 >= (int)slot.RowCuts.size() * 3)
+			slot.IsSceneChange = true;
+		//Every region is being sent already and no block was left out, so it can be a keyframe. Not if it uses
+		//long-term references though: the decoder updates them from it like any other frame. Otherwise the keyframe
+		//interval carries on, so the next recovery point isn't put off.
+		if (cutRows == (int)slot.RowCuts.size() && !slot.Image->References()) {
+			slot.Image->TemporalBlocks() = false;
+			slot.IsKeyframe = true;
+			_SceneKeyframe = true;
+		}
+	}
+	//The solid masks cost 2 bytes a region, so they're only worth it with enough solid blocks
+	int solidSavings = 0;
+	for (size_t i = 0; i < slot.RowSolidSavings.size(); i++)
+		solidSavings += slot.RowSolidSavings[i];
+	slot.Image->SolidBlocks() = _SolidBlocks && solidSavings > 0;
+	int length = Encoder::EncodeImage(*slot.Image, slot.Differences, output);
+
+	auto finished = Scheduler::Clock::now();
+	{
+		std::lock_guard<std::mutex> lock(_TierMutex);
+		double secs = std::chrono::duration<double>(finished - started).count();
+		_FinishSecs = _FinishSecs == 0 ? secs : _FinishSecs * 0.9 + secs * 0.1;
+	}
+
+	slot.MissedDeadline = slot.HasDeadline && finished > slot.Deadline;
+	if (slot.MissedDeadline)
+		_DeadlineMisses++;
+	for (size_t i = 0; i < slot.RowTiers.size(); i++) {
+		if (slot.RowTiers[i] != TIER_FULL) {
+			_DegradedFrames++;
+			break;
+		}
+	}
+	_LastFinished = frameNumber;
+	return length;
+}
@@ -0,0 +1,212 @@
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include "BGRColor.h"
+#include "InputFormats.h"
+#include "CompressedImage.h"
+#include "ImageDiff.h"
+#include "ReferenceSet.h"
+#include <atomic>
+#include <mutex>
+
+//Encodes a stream of frames, keeping the previous frame around as the temporal reference.
+//Regions which are similar enough to the previous frame's are reused and left out of the serialized frame.
+//
+//Several frames can be in flight at once: a row of regions only depends on the same row of the frame before it, so
+//frame N+1's top rows can be encoded while frame N's bottom rows are still being worked on.
+class StreamEncoder
+{
+public:
+	//How much work a row of regions gets, from the most to the least. Rows are dropped down the tiers when the frame
+	//would otherwise miss its deadline (see HoldDeadlines()).
+	enum QualityTier {
+		//Everything: block sizes are picked, and blocks and long-term references are reused as well as regions
+		TIER_FULL,
+		//The blocks are built without picking their sizes, and only whole regions are reused
+		TIER_FAST,
+		//The row isn't built at all: the previous frame's is reused as it is, but for the region being refreshed
+		TIER_SKIP,
+		TIER_COUNT
+	};
+private:
+	//Everything one frame needs while it is being encoded. There's one per frame in flight, plus one for the frame
+	//before them (the reference), used round robin.
+	struct FrameSlot {
+		CompressedImage* Image;
+		ImageDiff* Differences;
+		bool IsKeyframe;
+		//The column of regions being force refreshed this frame, or -1
+		int RefreshColumn;
+		//Which rows of regions looked like a scene change (so were sent whole, without being diffed)
+		std::vector<char> RowCuts;
+		bool IsSceneChange;
+		//When the frame is due, if it has a deadline
+		bool HasDeadline;
+		Scheduler::TimePoint Deadline;
+		//How many rows have been started, and the tier each was encoded at
+		int RowsStarted;
+		std::vector<uint8_t> RowTiers;
+		//How many regions of each row had the same pixels as the previous frame's, so weren't built
+		std::vector<int> RowUnchanged;
+		//How many bytes coding each row's solid blocks in just their color would save (see Region::SolidSavingsBytes())
+		std::vector<int> RowSolidSavings;
+		bool MissedDeadline;
+		//Each region's similarity threshold, or empty for SimilarityThreshold() everywhere
+		std::vector<int> Thresholds;
+	};
+	std::vector<FrameSlot> _Slots;
+	int _SimilarityThreshold;
+	std::vector<int> _RegionThresholds;
+	//The number BeginFrame() gives the next frame, and the last frame to be finished
+	int _NextFrame = 0;
+	int _LastFinished = -1;
+
+	//Group of pictures settings
+	int _KeyframeInterval = 0;
+	bool _IntraRefresh = false;
+	bool _KeyframeRequested = false;
+	bool _Adaptive = false;
+	bool _TemporalBlockSkip = false;
+	bool _LongTermReferences = false;
+	bool _SkipUnchangedRegions = true;
+	bool _SolidBlocks = false;
+	bool _YCoCgColors = false;
+	ReferenceSet _References;
+	//The state carried from frame to frame
+	int _FramesSinceKeyframe = 0;
+	int _RefreshColumn = -1;
+	//Set when a scene change is finished as a keyframe, so the next frame begun restarts the keyframe interval
+	std::atomic<bool> _SceneKeyframe;
+	bool _SceneChangeDetection = true;
+	//Deadline keeping: how long the rows take at each tier and serializing takes (moving averages, 0 until measured),
+	//and the counters
+	bool _HoldDeadlines = false;
+	Scheduler::Clock::duration _FrameBudget = Scheduler::Clock::duration::zero();
+	std::mutex _TierMutex;
+	double _RowSecs[TIER_COUNT] = {};
+	double _FinishSecs = 0;
+	std::atomic<int> _DeadlineMisses, _DegradedFrames;
+
+	inline FrameSlot& Slot(int frame) { return _Slots[frame % _Slots.size()]; }
+	inline FrameSlot& LastFinished() { return Slot(_LastFinished < 0 ? 0 : _LastFinished); }
+	inline int RegionThreshold(FrameSlot& slot, int x, int y) { return slot.Thresholds.empty() ? _SimilarityThreshold : slot.Thresholds[y * slot.Image->RegionsWide() + x]; }
+	//Scales the differences of a row of regions which have thresholds of their own, so the diff's single threshold
+	//tells which are similar
+	void ApplyRegionThresholds(FrameSlot& slot, int regionY);
+	//Picks the tier of the next row of a frame, given how long the frame has left. Must hold _TierMutex.
+	QualityTier ChooseTier(FrameSlot& slot, Scheduler::TimePoint now);
+	void EncodeRegionRow(FrameSlot& slot, int frameNumber, const InputFrame& frame, int regionY, QualityTier tier);
+	//Makes the temporal decisions about a row whose regions have been set: reuses the regions and blocks which are
+	//similar to the previous frame's or to a long-term reference
+	void ResolveRegionRow(FrameSlot& slot, int frameNumber, int regionY, QualityTier tier);
+	void TallySolidSavings(FrameSlot& slot, int regionY);
+	//Reuses the previous frame's row as it is, but for the region being refreshed
+	void SkipRegionRow(FrameSlot& slot, int frameNumber, const InputFrame& frame, int regionY);
+	//Whether most of a row of regions moved on too far from the previous frame's for any of them to be similar
+	bool IsSceneChangeRow(CompressedImage& previous, CompressedImage& current, int regionY);
+	//Copies the regions of a row which match a long-term reference from it (if told to match them), and updates the
+	//references with the row
+	void MatchReferences(FrameSlot& slot, CompressedImage& previous, int refreshColumn, bool match, int regionY);
+public:
+	inline int Width() { return _Slots[0].Image->SourceWidth(); }
+	inline int Height() { return _Slots[0].Image->SourceHeight(); }
+	inline int RegionsTall() { return _Slots[0].Image->RegionsTall(); }
+	//The most frames which can be between BeginFrame() and FinishFrame() at once
+	inline int MaxFramesInFlight() { return (int)_Slots.size() - 1; }
+	//The threshold below which a region is considered unchanged. 0 turns off temporal deduplication.
+	inline int& SimilarityThreshold() { return _SimilarityThreshold; }
+	//A threshold for each region (row by row, RegionsWide() x RegionsTall()) to use instead of SimilarityThreshold() in
+	//the frames begun from now on, e.g. from a look at the frames to come (see LookaheadEncoder). Empty for none.
+	inline std::vector<int>& RegionThresholds() { return _RegionThresholds; }
+	//Sends a keyframe (every region, no temporal reuse) every N frames. 0 means only the first frame is a keyframe.
+	//Keyframes are recovery points: they stop small differences from piling up and let late joiners start decoding.
+	inline int& KeyframeInterval() { return _KeyframeInterval; }
+	//Forces one column of regions per frame to be resent, sweeping left to right. Bounds drift and lets a late joiner
+	//build up a full picture within RegionsWide() frames, without the bitrate spike of a full keyframe.
+	inline bool& IntraRefresh() { return _IntraRefresh; }
+	//Codes each region with block sizes to suit its content: one block for flat regions, 4x4 pixel quarters for detailed
+	//blocks (see Region::RegionMode). Changing it makes the next frame a keyframe.
+	inline bool& AdaptiveBlockSizes() { return _Adaptive; }
+	//Within the regions which are resent, leaves out the blocks which are similar to the previous frame's (see
+	//Region::TemporalMask), so a small change costs about as much as the blocks it covers rather than whole regions
+	inline bool& TemporalBlockSkip() { return _TemporalBlockSkip; }
+	//Codes the blocks which are one color all over (sky, walls, backgrounds) in just their color. Each frame only uses
+	//them if they save more than the masks they need.
+	inline bool& SolidBlocks() { return _SolidBlocks; }
+	//Stores the blocks' colors as YCoCg (see YCoCgColor) instead of RGB 565: finer luma, and SimilarityThreshold() and
+	//the block matching weigh luma at half and chroma on its own (see Block::DifferenceFactor()), so lighting flicker and
+	//auto-exposure let more blocks and regions be reused. Changing it makes the next frame a keyframe.
+	inline bool& YCoCgColors() { return _YCoCgColors; }
+	//Copies regions which changed from the previous frame but match an older frame, or the background, from the long-term
+	//references (see ReferenceSet) instead of sending them. The decoder needs a ReferenceSet with the same settings as
+	//References(). Can be turned on or off at any frame.
+	inline bool& LongTermReferences() { return _LongTermReferences; }
+	//The encoder's long-term references
+	inline ReferenceSet& References() { return _References; }
+	//Copies the regions whose source pixels are exactly the same as the previous frame's instead of building them again
+	//(see CompressedImage::PixelHash()). Keyframes and the column being refreshed are always built.
+	inline bool& SkipUnchangedRegions() { return _SkipUnchangedRegions; }
+	//How many regions of the most recently encoded frame were copied for having the same pixels
+	int UnchangedRegions();
+	//Makes the next frame a keyframe (e.g. when a decoder reports it lost data)
+	inline void RequestKeyframe() { _KeyframeRequested = true; }
+	//Looks out for cuts and lighting changes while the regions are built. The rows they affect are sent without being
+	//compared to the previous frame (they'd hardly match), and a frame where every row is affected is sent as a keyframe.
+	inline bool& SceneChangeDetection() { return _SceneChangeDetection; }
+	//Whether the most recently encoded frame was a keyframe
+	inline bool IsKeyframe() { return LastFinished().IsKeyframe; }
+	//Whether the most recently encoded frame was detected as a scene change
+	inline bool IsSceneChange() { return LastFinished().IsSceneChange; }
+
+	//Drops the rows of a frame to cheaper tiers as they're started, when the rows left wouldn't be done by the frame's
+	//deadline at the tier they're at -- quality gives way so frames don't back up. Only frames with a deadline are
+	//affected, and keyframe rows are never skipped.
+	inline bool& HoldDeadlines() { return _HoldDeadlines; }
+	//The deadline EncodeFrame() gives each frame, from when it is called. Zero means no deadline.
+	inline Scheduler::Clock::duration& FrameBudget() { return _FrameBudget; }
+	//How many frames were finished after their deadline, and how many had rows below TIER_FULL, so far
+	inline int DeadlineMisses() { return _DeadlineMisses; }
+	inline int DegradedFrames() { return _DegradedFrames; }
+	//Whether the most recently encoded frame was finished after its deadline
+	inline bool MissedDeadline() { return LastFinished().MissedDeadline; }
+	//How many rows of the most recently encoded frame were encoded at a tier
+	int RowsAtTier(QualityTier tier);
+
+	//The most recently encoded frame, after temporal deduplication (i.e. what the decoder will see)
+	inline CompressedImage& Image() { return *LastFinished().Image; }
+	//The differences between the most recently encoded frame and the one before it
+	inline ImageDiff& Differences() { return *LastFinished().Differences; }
+
+	StreamEncoder(int width, int height, int similarityThreshold = 768, int maxFramesInFlight = 1, int recentReferences = 2, int backgroundDelay = 30);
+	~StreamEncoder();
+
+	//Encodes a frame from a row-ordered RGB array and returns its serialized form. Blocks until it's done.
+	inline std::vector<uint8_t> EncodeFrame(BGRColor* colorData) { return EncodeFrame(InputFrame::BGR24(colorData, Width())); }
+	//Encodes a frame in any of the supported input formats and returns its serialized form. Blocks until it's done.
+	std::vector<uint8_t> EncodeFrame(const InputFrame& frame);
+	//Encodes a frame straight into a buffer of at least MaxEncodedSize() bytes. Returns the number of bytes written.
+	int EncodeFrame(const InputFrame& frame, uint8_t* output);
+	//The largest a serialized frame of this stream can be
+	int MaxEncodedSize();
+
+	//The steps of EncodeFrame(), for callers that schedule the work themselves:
+	//BeginFrame(), then EncodeRegionRow() once for every row of regions, then FinishFrame(). Rows can be encoded from
+	//any thread in any order, as long as each row is only started once the same row of the previous frame is done.
+	//Frames must be finished in order, and no more than MaxFramesInFlight() can be begun but not finished.
+
+	//Starts a frame and returns its number, which the other steps take
+	int BeginFrame();
+	//Starts a frame which is due at a set time
+	int BeginFrame(Scheduler::TimePoint deadline);
+	//Builds a row of regions and reuses the ones which are similar to the previous frame's (unless they're being refreshed),
+	//or to a long-term reference if LongTermReferences() is on, as well as the similar blocks of the rest if
+	//TemporalBlockSkip() is on
+	void EncodeRegionRow(int frameNumber, const InputFrame& frame, int regionY);
+	//Encodes a row from an image of the same size whose regions were already built from the frame (with the same
+	//AdaptiveBlockSizes()), so only the temporal decisions are left. Images can be built ahead for many frames at once
+	//(see BatchEncoder). Always at TIER_FULL.
+	void EncodeRegionRow(int frameNumber, CompressedImage& built, int regionY);
+	//Serializes the frame
+	std::vector<uint8_t> FinishFrame(int frameNumber);
+	int FinishFrame(int frameNumber, uint8_t* output);
+};
@@ -0,0 +1,77 @@
+#pragma once
+#include <stdint.h>
+#include <sstream>
+#include <string>
+//Represents a color in 16 bits as its luma (Y) and two chroma differences: orange-blue (Co) and green-magenta (Cg).
+//The luma gets 6 bits and is rounded, so a change in brightness moves Y alone, and less than RGB 565's channels do.
+//
+//Worked in integers on R + 2G + B (4Y), R - B (2Co) and 2G - R - B (4Cg), so the encoder and decoder convert exactly
+//the same way on any compiler. Each chroma difference has 31 levels centered on 0: grays stay gray.
+class YCoCgColor
+{
+private:
+	uint16_t _backing;
+
+	//4Y, back to 0-1020
+	inline int Luma4() { return (Y() * 1020 * 2 + YLevels) / (YLevels * 2); }
+
+	//A channel from 4 times its value, rounded and clamped
+	inline static uint8_t Channel(int quadruple) {
+		quadruple += 2;
+		return quadruple < 0 ? 0 : quadruple >= 255 * 4 ? 255 : (uint8_t)(quadruple >> 2);
+	}
+	//Rounds a value of -range to range to one of -levels to levels, halves away from 0
+	inline static int Quantize(int value, int range, int levels) {
+		return (value * levels * 2 + (value < 0 ? -range : range)) / (range * 2);
+	}
+public:
+	static const int
+		ColorDepthBits = 16, // Must be power of two -- do not change
+		SizeBits = ColorDepthBits,
+		SizeBytes = SizeBits / 8,
+		YBits = 6,
+		CoBits = 5,
+		CgBits = 5,
+		YLevels = (1 << YBits) - 1,
+		//Either side of 0
+		CoLevels = (1 << (CoBits - 1)) - 1,
+		CgLevels = (1 << (CgBits - 1)) - 1;
+
+	//The luma, and the chroma levels, from -CoLevels/-CgLevels to CoLevels/CgLevels
+	inline int Y() { return _backing >> (CoBits + CgBits); }
+	inline int Co() { return ((_backing >> CgBits) & ((1 << CoBits) - 1)) - CoLevels; }
+	inline int Cg() { return (_backing & ((1 << CgBits) - 1)) - CgLevels; }
+	inline uint16_t Backing() { return _backing; }
+
+	//The color in RGB. 2Co steps by 17 and 4Cg by 34 (255 / 15 and 510 / 15).
+	inline uint8_t R() { return Channel(Luma4() + Co() * (255 / CoLevels) * 2 - Cg() * (510 / CgLevels)); }
+	inline uint8_t G() { return Channel(Luma4() + Cg() * (510 / CgLevels)); }
+	inline uint8_t B() { return Channel(Luma4() - Co() * (255 / CoLevels) * 2 - Cg() * (510 / CgLevels)); }
+
+	YCoCgColor()
+	{
+	}
+
+	YCoCgColor(uint8_t r, uint8_t g, uint8_t b) {
+		int y = ((r + 2 * g + b) * YLevels * 2 + 1020) / (1020 * 2);
+		int co = Quantize(r - b, 255, CoLevels);
+		int cg = Quantize(2 * g - r - b, 510, CgLevels);
+		_backing = (uint16_t)((y << (CoBits + CgBits)) | ((co + CoLevels) << CgBits) | (cg + CgLevels));
+	}
+
+	~YCoCgColor()
+	{
+	}
+
+	inline static YCoCgColor CreateFromBacking(uint16_t backing) {
+		YCoCgColor color;
+		color._backing = backing;
+		return color;
+	}
+
+	std::string ToString() {
+		std::ostringstream stream;
+		stream << "{Y:" << Y() << ",Co:" << Co() << ",Cg:" << Cg() << "}";
+		return stream.str();
+	}
+};
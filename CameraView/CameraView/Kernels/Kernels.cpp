@@ -0,0 +1,223 @@
+#include "Kernels.h"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#ifdef KERNELS_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace Kernels
+{
+	namespace Scalar
+	{
+		int IndexDifference(const uint8_t * a, const uint8_t * b)
+		{
+			int diff = 0;
+			for (int i = 0; i < 16; i++)
+				for (int shift = 0; shift < 8; shift += 2)
+					diff += abs(((a[i] >> shift) & 0b11) - ((b[i] >> shift) & 0b11));
+			return diff;
+		}
+
+		int ChooseBlends(const uint8_t * pixels, int count, const uint32_t * palette, uint8_t * factors)
+		{
+			int error = 0;
+			for (int i = 0; i < count; i++, pixels += 4) {
+				int best = 0, bestDistance = INT32_MAX;
+				for (int j = 0; j < 4; j++) {
+					int distance =
+						abs(pixels[0] - (int)(palette[j] & 0xFF)) +
+						abs(pixels[1] - (int)((palette[j] >> 8) & 0xFF)) +
+						abs(pixels[2] - (int)((palette[j] >> 16) & 0xFF));
+					if (distance < bestDistance) {
+						best = j;
+						bestDistance = distance;
+					}
+				}
+				factors[i] = (uint8_t)best;
+				error += bestDistance;
+			}
+			return error;
+		}
+
+		void ExpandRow32(uint32_t * out, const uint32_t * palette, int rowBits)
+		{
+			for (int x = 0; x < 8; x++)
+				out[x] = palette[(rowBits >> (x * 2)) & 0b11];
+		}
+
+		void ExpandRow16(uint16_t * out, const uint16_t * palette, int rowBits)
+		{
+			for (int x = 0; x < 8; x++)
+				out[x] = palette[(rowBits >> (x * 2)) & 0b11];
+		}
+
+		uint64_t HashBytes(const uint8_t * data, int length)
+		{
+			//Each lane takes its 4 bytes of every stripe through an xxHash32 style round
+			uint32_t lanes[HashLanes];
+			for (int j = 0; j < HashLanes; j++)
+				lanes[j] = (uint32_t)(j + 1) * 2654435761u;
+			for (int i = 0; i < length; i += HashStripeBytes)
+				for (int j = 0; j < HashLanes; j++) {
+					uint32_t word;
+					memcpy(&word, data + i + j * 4, 4);
+					uint32_t lane = lanes[j] + word * 2246822519u;
+					lanes[j] = ((lane << 13) | (lane >> 19)) * 2654435761u;
+				}
+			return FinishHash(lanes, length);
+		}
+	}
+
+	uint64_t FinishHash(const uint32_t * lanes, int length)
+	{
+		uint64_t hash = (uint64_t)length;
+		for (int j = 0; j < HashLanes; j++) {
+			hash = (hash ^ lanes[j]) * 0x9E3779B97F4A7C15ull;
+			hash ^= hash >> 32;
+		}
+		return hash;
+	}
+
+	//One per level this build has, in order
+	static const KernelTable Tables[] = {
+		{ Scalar::IndexDifference, Scalar::ChooseBlends, Scalar::ExpandRow32, Scalar::ExpandRow16, Scalar::HashBytes },
+#ifdef KERNELS_X86
+		{ SSE41::IndexDifference, SSE41::ChooseBlends, SSE41::ExpandRow32, SSE41::ExpandRow16, SSE41::HashBytes },
+		//Rows of 16 bit pixels are only 128 bits, so the wider levels keep the SSE4.1 version. The hash's 8 lanes fill
+		//an AVX2 register already.
+		{ AVX2::IndexDifference, AVX2::ChooseBlends, AVX2::ExpandRow32, SSE41::ExpandRow16, AVX2::HashBytes },
+#ifdef KERNELS_AVX512
+		{ AVX512::IndexDifference, AVX512::ChooseBlends, AVX2::ExpandRow32, SSE41::ExpandRow16, AVX2::HashBytes },
+#endif
+#endif
+	};
+
+	static void CpuId(int leaf, int subleaf, unsigned int registers[4])
+	{
+#if defined(KERNELS_X86) && defined(_MSC_VER)
+		__cpuidex((int*)registers, leaf, subleaf);
+#elif defined(KERNELS_X86)
+		__cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#else
+		registers[0] = registers[1] = registers[2] = registers[3] = 0;
+#endif
+	}
+
+	//Which register states the OS saves on a context switch. AVX is no use if the upper halves are lost.
+	static uint64_t EnabledRegisterStates()
+	{
+#if defined(KERNELS_X86) && defined(_MSC_VER)
+		return _xgetbv(0);
+#elif defined(KERNELS_X86)
+		uint32_t low, high;
+		__asm__ volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+		return ((uint64_t)high << 32) | low;
+#else
+		return 0;
+#endif
+	}
+
+	static Level DetectLevel()
+	{
+		unsigned int registers[4];
+		CpuId(0, 0, registers);
+		int maxLeaf = (int)registers[0];
+		if (maxLeaf < 1)
+			return LEVEL_SCALAR;
+
+		CpuId(1, 0, registers);
+		bool sse41 = (registers[2] & (1 << 19)) != 0;
+		bool osxsave = (registers[2] & (1 << 27)) != 0;
+		bool avx = (registers[2] & (1 << 28)) != 0;
+		if (!sse41)
+			return LEVEL_SCALAR;
+		if (!osxsave || !avx || maxLeaf < 7)
+			return LEVEL_SSE41;
+
+		uint64_t states = EnabledRegisterStates();
+		//SSE and AVX state
+		if ((states & 0x6) != 0x6)
+			return LEVEL_SSE41;
+
+		CpuId(7, 0, registers);
+		bool avx2 = (registers[1] & (1 << 5)) != 0;
+		bool avx512f = (registers[1] & (1 << 16)) != 0;
+		bool avx512bw = (registers[1] & (1 << 30)) != 0;
+		if (!avx2)
+			return LEVEL_SSE41;
+		//Opmask and the upper 256 bits of the first 16 ZMM registers, and all of the other 16
+		if (!avx512f || !avx512bw || (states & 0xE0) != 0xE0)
+			return LEVEL_AVX2;
+		return LEVEL_AVX512;
+	}
+
+	static Level Supported()
+	{
+		static Level supported = [] {
+			Level detected = DetectLevel();
+			Level built = (Level)(sizeof(Tables) / sizeof(Tables[0]) - 1);
+			return detected < built ? detected : built;
+		}();
+		return supported;
+	}
+
+	static std::atomic<int>& Current()
+	{
+		//Bound once, the first time any kernel is used
+		static std::atomic<int> current([] {
+			Level level = Supported();
+			Level requested;
+			const char* name = getenv("CAMERAVIEW_SIMD");
+			if (name != nullptr && ParseLevel(name, &requested) && requested < level)
+				level = requested;
+			return (int)level;
+		}());
+		return current;
+	}
+
+	const KernelTable & Active()
+	{
+		return Tables[Current().load(std::memory_order_relaxed)];
+	}
+
+	Level ActiveLevel()
+	{
+		return (Level)Current().load();
+	}
+
+	Level SupportedLevel()
+	{
+		return Supported();
+	}
+
+	Level SetLevel(Level level)
+	{
+		if (level > Supported())
+			level = Supported();
+		Current().store((int)level);
+		return level;
+	}
+
+	static const char* const LevelNames[LEVEL_COUNT] = { "scalar", "sse4.1", "avx2", "avx512" };
+
+	const char * LevelName(Level level)
+	{
+		return LevelNames[level];
+	}
+
+	bool ParseLevel(const char * name, Level * level)
+	{
+		for (int i = 0; i < LEVEL_COUNT; i++) {
+			if (strcmp(name, LevelNames[i]) == 0) {
+				*level = (Level)i;
+				return true;
+			}
+		}
+		return false;
+	}
+}
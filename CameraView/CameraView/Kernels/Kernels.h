@@ -0,0 +1,95 @@
+#pragma once
+#include <stdint.h>
+
+//The codec's hot loops, built for several instruction sets. The best version the CPU supports is bound at startup, so
+//a single binary runs at full speed on every machine in a mixed fleet and still runs (on the scalar versions) on
+//anything else.
+//
+//The level can be forced for benchmarking and A/B testing, either with SetLevel() or the CAMERAVIEW_SIMD environment
+//variable ("scalar", "sse4.1", "avx2" or "avx512"). Every level gives bit identical results.
+//
+//Kernels only deal in plain bytes and integers: the files built for higher instruction sets must not include headers with
+//inline functions, or the linker could pick their AVX copies for use everywhere.
+namespace Kernels
+{
+	enum Level {
+		LEVEL_SCALAR,
+		LEVEL_SSE41,
+		LEVEL_AVX2,
+		//AVX-512 F and BW
+		LEVEL_AVX512,
+		LEVEL_COUNT
+	};
+
+	struct KernelTable {
+		//Sums the absolute differences between the 2 bit blend factors of two blocks' pixel data (16 bytes each)
+		int(*IndexDifference)(const uint8_t* a, const uint8_t* b);
+		//Picks the closest of the 4 palette colors for each BGRA pixel (sum of the channel differences, alpha ignored,
+		//the first one on ties) and writes its index to factors. Returns the sum of the distances.
+		int(*ChooseBlends)(const uint8_t* pixels, int count, const uint32_t* palette, uint8_t* factors);
+		//Writes a row of 8 pixels of a block from its 16 bits of blend factors, in 32 and 16 bit formats
+		void(*ExpandRow32)(uint32_t* out, const uint32_t* palette, int rowBits);
+		void(*ExpandRow16)(uint16_t* out, const uint16_t* palette, int rowBits);
+		//Hashes a run of bytes (a multiple of HashStripeBytes long) to 64 bits, e.g. to spot pixels which haven't changed.
+		//Not cryptographic, but any change at all is as good as certain to change the hash.
+		uint64_t(*HashBytes)(const uint8_t* data, int length);
+	};
+
+	//HashBytes() works on 32 byte stripes: a 32 bit lane per 4 bytes of each stripe
+	static const int HashStripeBytes = 32, HashLanes = 8;
+	//Mixes HashBytes()' lanes down to the hash, the same for every level
+	uint64_t FinishHash(const uint32_t* lanes, int length);
+
+	//The kernels in use. Bound to the best level the CPU supports (or the one asked for) on first use.
+	const KernelTable& Active();
+	Level ActiveLevel();
+	//The best level the CPU (and OS) supports, and this build can use
+	Level SupportedLevel();
+	//Forces a level. It's capped to the supported level; returns the level actually used. Safe to call at any time,
+	//though work in flight may finish on the old kernels.
+	Level SetLevel(Level level);
+
+	const char* LevelName(Level level);
+	//Reads a level name as LevelName() writes them. Returns false if it isn't one.
+	bool ParseLevel(const char* name, Level* level);
+
+	//The implementations for each level. Use Active() rather than calling these directly.
+	namespace Scalar {
+		int IndexDifference(const uint8_t* a, const uint8_t* b);
+		int ChooseBlends(const uint8_t* pixels, int count, const uint32_t* palette, uint8_t* factors);
+		void ExpandRow32(uint32_t* out, const uint32_t* palette, int rowBits);
+		void ExpandRow16(uint16_t* out, const uint16_t* palette, int rowBits);
+		uint64_t HashBytes(const uint8_t* data, int length);
+	}
+	namespace SSE41 {
+		int IndexDifference(const uint8_t* a, const uint8_t* b);
+		int ChooseBlends(const uint8_t* pixels, int count, const uint32_t* palette, uint8_t* factors);
+		void ExpandRow32(uint32_t* out, const uint32_t* palette, int rowBits);
+		void ExpandRow16(uint16_t* out, const uint16_t* palette, int rowBits);
+		uint64_t HashBytes(const uint8_t* data, int length);
+	}
+	namespace AVX2 {
+		int IndexDifference(const uint8_t* a, const uint8_t* b);
+		int ChooseBlends(const uint8_t* pixels, int count, const uint32_t* palette, uint8_t* factors);
+		void ExpandRow32(uint32_t* out, const uint32_t* palette, int rowBits);
+		uint64_t HashBytes(const uint8_t* data, int length);
+	}
+	namespace AVX512 {
+		int IndexDifference(const uint8_t* a, const uint8_t* b);
+		int ChooseBlends(const uint8_t* pixels, int count, const uint32_t* palette, uint8_t* factors);
+	}
+}
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86
+#endif
+//Lets GCC and Clang use an instruction set in one function. MSVC allows any intrinsic anywhere.
+#if defined(__GNUC__)
+#define KERNEL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define KERNEL_TARGET(isa)
+#endif
+//AVX-512 intrinsics need VS2017 15.3 or newer
+#if defined(KERNELS_X86) && (defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1911))
+#define KERNELS_AVX512
+#endif
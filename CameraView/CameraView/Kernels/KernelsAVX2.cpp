@@ -0,0 +1,102 @@
+#include "Kernels.h"
+#ifdef KERNELS_X86
+#include <immintrin.h>
+#include <cstring>
+
+namespace Kernels
+{
+	namespace AVX2
+	{
+		//The sum of the channel differences between 8 pixels and a color, in 32 bit lanes
+		KERNEL_TARGET("avx2") static inline __m256i Distance(__m256i pixels, __m256i color)
+		{
+			__m256i difference = _mm256_or_si256(_mm256_subs_epu8(pixels, color), _mm256_subs_epu8(color, pixels));
+			return _mm256_madd_epi16(_mm256_maddubs_epi16(difference, _mm256_set1_epi8(1)), _mm256_set1_epi16(1));
+		}
+
+		KERNEL_TARGET("avx2") int IndexDifference(const uint8_t * a, const uint8_t * b)
+		{
+			//Both halves of the register hold the whole block, shifted differently: two of the four shifts per instruction
+			__m256i first = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)a));
+			__m256i second = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)b));
+			const __m256i mask = _mm256_set1_epi8(0b11);
+			const __m256i shiftsLow = _mm256_setr_epi64x(0, 0, 4, 4), shiftsHigh = _mm256_setr_epi64x(2, 2, 6, 6);
+
+			__m256i sum = _mm256_sad_epu8(
+				_mm256_and_si256(_mm256_srlv_epi64(first, shiftsLow), mask),
+				_mm256_and_si256(_mm256_srlv_epi64(second, shiftsLow), mask));
+			sum = _mm256_add_epi64(sum, _mm256_sad_epu8(
+				_mm256_and_si256(_mm256_srlv_epi64(first, shiftsHigh), mask),
+				_mm256_and_si256(_mm256_srlv_epi64(second, shiftsHigh), mask)));
+			__m128i half = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+			return _mm_cvtsi128_si32(half) + _mm_extract_epi16(half, 4);
+		}
+
+		KERNEL_TARGET("avx2") int ChooseBlends(const uint8_t * pixels, int count, const uint32_t * palette, uint8_t * factors)
+		{
+			//Alpha is masked off both sides so it never counts
+			const __m256i colorMask = _mm256_set1_epi32(0x00FFFFFF);
+			__m256i colors[4];
+			for (int j = 0; j < 4; j++)
+				colors[j] = _mm256_set1_epi32((int)(palette[j] & 0x00FFFFFF));
+			//Gathers the low byte of each lane into the bottom 4 bytes of each half
+			const __m256i packFactors = _mm256_setr_epi8(
+				0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+				0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+
+			__m256i error = _mm256_setzero_si256();
+			int i = 0;
+			for (; i + 8 <= count; i += 8) {
+				__m256i block = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(pixels + i * 4)), colorMask);
+				__m256i best = Distance(block, colors[0]);
+				__m256i factor = _mm256_setzero_si256();
+				for (int j = 1; j < 4; j++) {
+					__m256i distance = Distance(block, colors[j]);
+					//Only strictly closer colors win, same as the scalar search
+					__m256i closer = _mm256_cmpgt_epi32(best, distance);
+					best = _mm256_min_epi32(best, distance);
+					factor = _mm256_blendv_epi8(factor, _mm256_set1_epi32(j), closer);
+				}
+				error = _mm256_add_epi32(error, best);
+				__m256i packed = _mm256_shuffle_epi8(factor, packFactors);
+				int low = _mm256_extract_epi32(packed, 0), high = _mm256_extract_epi32(packed, 4);
+				memcpy(factors + i, &low, 4);
+				memcpy(factors + i + 4, &high, 4);
+			}
+			__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(error), _mm256_extracti128_si256(error, 1));
+			sum = _mm_hadd_epi32(sum, sum);
+			sum = _mm_hadd_epi32(sum, sum);
+			int total = _mm_cvtsi128_si32(sum);
+			//Any odd pixels at the end
+			if (i < count)
+				total += SSE41::ChooseBlends(pixels + i * 4, count - i, palette, factors + i);
+			return total;
+		}
+
+		KERNEL_TARGET("avx2") void ExpandRow32(uint32_t * out, const uint32_t * palette, int rowBits)
+		{
+			//A variable shift pulls each pixel's factor out, and a permute looks all 8 up in the palette at once
+			__m256i colors = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)palette));
+			__m256i factors = _mm256_and_si256(
+				_mm256_srlv_epi32(_mm256_set1_epi32(rowBits), _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14)),
+				_mm256_set1_epi32(0b11));
+			_mm256_storeu_si256((__m256i*)out, _mm256_permutevar8x32_epi32(colors, factors));
+		}
+
+		KERNEL_TARGET("avx2") uint64_t HashBytes(const uint8_t * data, int length)
+		{
+			//A whole stripe per round
+			const __m256i prime1 = _mm256_set1_epi32((int)2654435761u), prime2 = _mm256_set1_epi32((int)2246822519u);
+			__m256i lanes = _mm256_mullo_epi32(_mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 8), prime1);
+			for (int i = 0; i < length; i += HashStripeBytes) {
+				lanes = _mm256_add_epi32(lanes, _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i*)(data + i)), prime2));
+				lanes = _mm256_or_si256(_mm256_slli_epi32(lanes, 13), _mm256_srli_epi32(lanes, 19));
+				lanes = _mm256_mullo_epi32(lanes, prime1);
+			}
+			uint32_t result[HashLanes];
+			_mm256_storeu_si256((__m256i*)result, lanes);
+			return FinishHash(result, length);
+		}
+	}
+}
+#endif
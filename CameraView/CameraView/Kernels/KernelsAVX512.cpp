@@ -0,0 +1,69 @@
+#include "Kernels.h"
+#ifdef KERNELS_AVX512
+#include <immintrin.h>
+#include <cstring>
+
+namespace Kernels
+{
+	namespace AVX512
+	{
+		//The sum of the channel differences between 16 pixels and a color, in 32 bit lanes
+		KERNEL_TARGET("avx512f,avx512bw") static inline __m512i Distance(__m512i pixels, __m512i color)
+		{
+			__m512i difference = _mm512_or_si512(_mm512_subs_epu8(pixels, color), _mm512_subs_epu8(color, pixels));
+			return _mm512_madd_epi16(_mm512_maddubs_epi16(difference, _mm512_set1_epi8(1)), _mm512_set1_epi16(1));
+		}
+
+		KERNEL_TARGET("avx512f,avx512bw") int IndexDifference(const uint8_t * a, const uint8_t * b)
+		{
+			//Each quarter of the register holds the whole block, shifted for one of the 4 factors in a byte
+			__m512i first = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*)a));
+			__m512i second = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*)b));
+			const __m512i mask = _mm512_set1_epi8(0b11);
+			const __m512i shifts = _mm512_setr_epi64(0, 0, 2, 2, 4, 4, 6, 6);
+
+			__m512i sum = _mm512_sad_epu8(
+				_mm512_and_si512(_mm512_srlv_epi64(first, shifts), mask),
+				_mm512_and_si512(_mm512_srlv_epi64(second, shifts), mask));
+			__m256i half = _mm256_add_epi64(_mm512_castsi512_si256(sum), _mm512_extracti64x4_epi64(sum, 1));
+			__m128i quarter = _mm_add_epi64(_mm256_castsi256_si128(half), _mm256_extracti128_si256(half, 1));
+			return _mm_cvtsi128_si32(quarter) + _mm_extract_epi16(quarter, 4);
+		}
+
+		KERNEL_TARGET("avx512f,avx512bw") int ChooseBlends(const uint8_t * pixels, int count, const uint32_t * palette, uint8_t * factors)
+		{
+			//Alpha is masked off both sides so it never counts
+			const __m512i colorMask = _mm512_set1_epi32(0x00FFFFFF);
+			__m512i colors[4];
+			for (int j = 0; j < 4; j++)
+				colors[j] = _mm512_set1_epi32((int)(palette[j] & 0x00FFFFFF));
+
+			__m512i error = _mm512_setzero_si512();
+			int i = 0;
+			for (; i + 16 <= count; i += 16) {
+				__m512i block = _mm512_and_si512(_mm512_loadu_si512((const void*)(pixels + i * 4)), colorMask);
+				__m512i best = Distance(block, colors[0]);
+				__m512i factor = _mm512_setzero_si512();
+				for (int j = 1; j < 4; j++) {
+					__m512i distance = Distance(block, colors[j]);
+					//Only strictly closer colors win, same as the scalar search
+					__mmask16 closer = _mm512_cmpgt_epi32_mask(best, distance);
+					best = _mm512_min_epi32(best, distance);
+					factor = _mm512_mask_mov_epi32(factor, closer, _mm512_set1_epi32(j));
+				}
+				error = _mm512_add_epi32(error, best);
+				_mm_storeu_si128((__m128i*)(factors + i), _mm512_cvtepi32_epi8(factor));
+			}
+			__m256i half = _mm256_add_epi32(_mm512_castsi512_si256(error), _mm512_extracti64x4_epi64(error, 1));
+			__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(half), _mm256_extracti128_si256(half, 1));
+			sum = _mm_hadd_epi32(sum, sum);
+			sum = _mm_hadd_epi32(sum, sum);
+			int total = _mm_cvtsi128_si32(sum);
+			//Any odd pixels at the end
+			if (i < count)
+				total += AVX2::ChooseBlends(pixels + i * 4, count - i, palette, factors + i);
+			return total;
+		}
+	}
+}
+#endif
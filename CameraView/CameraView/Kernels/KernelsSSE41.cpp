@@ -0,0 +1,117 @@
+#include "Kernels.h"
+#ifdef KERNELS_X86
+#include <smmintrin.h>
+#include <cstring>
+
+namespace Kernels
+{
+	namespace SSE41
+	{
+		//The sum of the channel differences between 4 pixels and a color, in 32 bit lanes
+		KERNEL_TARGET("sse4.1") static inline __m128i Distance(__m128i pixels, __m128i color)
+		{
+			__m128i difference = _mm_or_si128(_mm_subs_epu8(pixels, color), _mm_subs_epu8(color, pixels));
+			return _mm_madd_epi16(_mm_maddubs_epi16(difference, _mm_set1_epi8(1)), _mm_set1_epi16(1));
+		}
+
+		KERNEL_TARGET("sse4.1") int IndexDifference(const uint8_t * a, const uint8_t * b)
+		{
+			//Spread each of the 4 factors in a byte out into its own byte (shift and mask), and PSADBW sums the
+			//absolute differences of 16 of them at a time
+			__m128i first = _mm_loadu_si128((const __m128i*)a);
+			__m128i second = _mm_loadu_si128((const __m128i*)b);
+			const __m128i mask = _mm_set1_epi8(0b11);
+
+			__m128i sum = _mm_sad_epu8(_mm_and_si128(first, mask), _mm_and_si128(second, mask));
+			sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_and_si128(_mm_srli_epi16(first, 2), mask), _mm_and_si128(_mm_srli_epi16(second, 2), mask)));
+			sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_and_si128(_mm_srli_epi16(first, 4), mask), _mm_and_si128(_mm_srli_epi16(second, 4), mask)));
+			sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_and_si128(_mm_srli_epi16(first, 6), mask), _mm_and_si128(_mm_srli_epi16(second, 6), mask)));
+			//Each half of the register holds the sum for 8 bytes
+			return _mm_cvtsi128_si32(sum) + _mm_extract_epi16(sum, 4);
+		}
+
+		KERNEL_TARGET("sse4.1") int ChooseBlends(const uint8_t * pixels, int count, const uint32_t * palette, uint8_t * factors)
+		{
+			//Alpha is masked off both sides so it never counts
+			const __m128i colorMask = _mm_set1_epi32(0x00FFFFFF);
+			__m128i colors[4];
+			for (int j = 0; j < 4; j++)
+				colors[j] = _mm_set1_epi32((int)(palette[j] & 0x00FFFFFF));
+			//Gathers the low byte of each lane
+			const __m128i packFactors = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+
+			__m128i error = _mm_setzero_si128();
+			int i = 0;
+			for (; i + 4 <= count; i += 4) {
+				__m128i block = _mm_and_si128(_mm_loadu_si128((const __m128i*)(pixels + i * 4)), colorMask);
+				__m128i best = Distance(block, colors[0]);
+				__m128i factor = _mm_setzero_si128();
+				for (int j = 1; j < 4; j++) {
+					__m128i distance = Distance(block, colors[j]);
+					//Only strictly closer colors win, same as the scalar search
+					__m128i closer = _mm_cmpgt_epi32(best, distance);
+					best = _mm_min_epi32(best, distance);
+					factor = _mm_blendv_epi8(factor, _mm_set1_epi32(j), closer);
+				}
+				error = _mm_add_epi32(error, best);
+				int packed = _mm_cvtsi128_si32(_mm_shuffle_epi8(factor, packFactors));
+				memcpy(factors + i, &packed, 4);
+			}
+			error = _mm_hadd_epi32(error, error);
+			error = _mm_hadd_epi32(error, error);
+			int total = _mm_cvtsi128_si32(error);
+			//Any odd pixels at the end
+			if (i < count)
+				total += Scalar::ChooseBlends(pixels + i * 4, count - i, palette, factors + i);
+			return total;
+		}
+
+		KERNEL_TARGET("sse4.1") void ExpandRow32(uint32_t * out, const uint32_t * palette, int rowBits)
+		{
+			__m128i colors = _mm_loadu_si128((const __m128i*)palette);
+			//Move each pixel's factor to the top of its lane with a multiply (a per lane shift), then down to the bottom
+			const __m128i align = _mm_setr_epi32(1 << 30, 1 << 28, 1 << 26, 1 << 24);
+			__m128i low = _mm_srli_epi32(_mm_mullo_epi32(_mm_set1_epi32(rowBits), align), 30);
+			__m128i high = _mm_srli_epi32(_mm_mullo_epi32(_mm_set1_epi32(rowBits >> 8), align), 30);
+			//Turn the factors into byte shuffles of the palette: factor * 4 + {0, 1, 2, 3}
+			const __m128i scale = _mm_set1_epi32(0x04040404), offsets = _mm_set1_epi32(0x03020100);
+			_mm_storeu_si128((__m128i*)out, _mm_shuffle_epi8(colors, _mm_add_epi32(_mm_mullo_epi32(low, scale), offsets)));
+			_mm_storeu_si128((__m128i*)(out + 4), _mm_shuffle_epi8(colors, _mm_add_epi32(_mm_mullo_epi32(high, scale), offsets)));
+		}
+
+		KERNEL_TARGET("sse4.1") void ExpandRow16(uint16_t * out, const uint16_t * palette, int rowBits)
+		{
+			__m128i colors = _mm_loadl_epi64((const __m128i*)palette);
+			//Same as above, in 16 bit lanes: all 8 pixels in one go
+			const __m128i align = _mm_setr_epi16(1 << 14, 1 << 12, 1 << 10, 1 << 8, 1 << 6, 1 << 4, 1 << 2, 1);
+			__m128i factors = _mm_srli_epi16(_mm_mullo_epi16(_mm_set1_epi16((short)rowBits), align), 14);
+			__m128i shuffle = _mm_add_epi16(_mm_mullo_epi16(factors, _mm_set1_epi16(0x0202)), _mm_set1_epi16(0x0100));
+			_mm_storeu_si128((__m128i*)out, _mm_shuffle_epi8(colors, shuffle));
+		}
+
+		//One round of the hash on 4 lanes
+		KERNEL_TARGET("sse4.1") static inline __m128i HashRound(__m128i lanes, __m128i words)
+		{
+			lanes = _mm_add_epi32(lanes, _mm_mullo_epi32(words, _mm_set1_epi32((int)2246822519u)));
+			lanes = _mm_or_si128(_mm_slli_epi32(lanes, 13), _mm_srli_epi32(lanes, 19));
+			return _mm_mullo_epi32(lanes, _mm_set1_epi32((int)2654435761u));
+		}
+
+		KERNEL_TARGET("sse4.1") uint64_t HashBytes(const uint8_t * data, int length)
+		{
+			//Lanes 0-3 and 4-7
+			const __m128i prime = _mm_set1_epi32((int)2654435761u);
+			__m128i low = _mm_mullo_epi32(_mm_setr_epi32(1, 2, 3, 4), prime);
+			__m128i high = _mm_mullo_epi32(_mm_setr_epi32(5, 6, 7, 8), prime);
+			for (int i = 0; i < length; i += HashStripeBytes) {
+				low = HashRound(low, _mm_loadu_si128((const __m128i*)(data + i)));
+				high = HashRound(high, _mm_loadu_si128((const __m128i*)(data + i + 16)));
+			}
+			uint32_t lanes[HashLanes];
+			_mm_storeu_si128((__m128i*)lanes, low);
+			_mm_storeu_si128((__m128i*)(lanes + 4), high);
+			return FinishHash(lanes, length);
+		}
+	}
+}
+#endif
@@ -0,0 +1,75 @@
+#include "MappedFile.h"
+#include <stdexcept>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string & path, bool writable)
+{
+	Map(path, 0, false, writable);
+}
+
+MappedFile::MappedFile(const std::string & path, size_t size)
+{
+	Map(path, size, true, true);
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+	if (_Data != nullptr) UnmapViewOfFile(_Data);
+	if (_MappingHandle != nullptr) CloseHandle(_MappingHandle);
+	if (_FileHandle != nullptr) CloseHandle(_FileHandle);
+#else
+	if (_Data != nullptr) munmap(_Data, _Size);
+	if (_File >= 0) close(_File);
+#endif
+}
+
+void MappedFile::Map(const std::string & path, size_t size, bool create, bool writable)
+{
+#ifdef _WIN32
+	_FileHandle = CreateFileA(path.c_str(), writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+		create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (_FileHandle == INVALID_HANDLE_VALUE) {
+		_FileHandle = nullptr;
+		throw std::runtime_error("Could not open file: " + path);
+	}
+	if (!create) {
+		LARGE_INTEGER fileSize;
+		GetFileSizeEx(_FileHandle, &fileSize);
+		size = (size_t)fileSize.QuadPart;
+	}
+	if (size == 0)
+		throw std::runtime_error("Cannot map an empty file: " + path);
+	_MappingHandle = CreateFileMappingA(_FileHandle, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, (DWORD)((uint64_t)size >> 32), (DWORD)(size & 0xFFFFFFFF), nullptr);
+	if (_MappingHandle == nullptr)
+		throw std::runtime_error("Could not map file: " + path);
+	_Data = (uint8_t*)MapViewOfFile(_MappingHandle, writable ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, size);
+#else
+	_File = open(path.c_str(), create ? O_RDWR | O_CREAT | O_TRUNC : (writable ? O_RDWR : O_RDONLY), 0644);
+	if (_File < 0)
+		throw std::runtime_error("Could not open file: " + path);
+	if (create) {
+		if (ftruncate(_File, (off_t)size) != 0)
+			throw std::runtime_error("Could not size file: " + path);
+	}
+	else {
+		struct stat fileStat;
+		fstat(_File, &fileStat);
+		size = (size_t)fileStat.st_size;
+	}
+	if (size == 0)
+		throw std::runtime_error("Cannot map an empty file: " + path);
+	void* mapping = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, _File, 0);
+	_Data = mapping == MAP_FAILED ? nullptr : (uint8_t*)mapping;
+#endif
+	if (_Data == nullptr)
+		throw std::runtime_error("Could not map file: " + path);
+	_Size = size;
+}
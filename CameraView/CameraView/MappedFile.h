@@ -0,0 +1,32 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+//A file mapped into memory. Pages are only read from disk when they're touched.
+class MappedFile
+{
+private:
+	uint8_t* _Data = nullptr;
+	size_t _Size = 0;
+#ifdef _WIN32
+	void* _FileHandle = nullptr;
+	void* _MappingHandle = nullptr;
+#else
+	int _File = -1;
+#endif
+public:
+	inline uint8_t* Data() { return _Data; }
+	inline size_t Size() { return _Size; }
+
+	//Opens an existing file and maps all of it
+	MappedFile(const std::string& path, bool writable);
+	//Creates (or overwrites) a file of the given size and maps it for writing
+	MappedFile(const std::string& path, size_t size);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+private:
+	void Map(const std::string& path, size_t size, bool create, bool writable);
+};
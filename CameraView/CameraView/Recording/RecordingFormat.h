@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+
+/*
+* A recording is a file of serialized frames with an index, so it can be played back from any point without reading
+* the frames before it.
+*
+* The file is structured as such (all values big endian, like the frames themselves):
+*	16 byte file header:
+*		4 bytes magic "PPYV"
+*		2 bytes format version
+*		2 bytes width, 2 bytes height
+*		6 bytes reserved
+*	Then the frames, each exactly as produced by the Encoder, back to back. Every <FramesPerIndexChunk> frames, an index
+*	chunk is written between them:
+*		4 bytes magic "PPYI"
+*		4 bytes number of entries
+*		8 bytes offset of the previous index chunk (0 for the first)
+*		21 bytes per frame: 8 bytes offset, 4 bytes length, 8 bytes timestamp (microseconds), 1 byte flags
+*	And the file ends with a 16 byte trailer:
+*		8 bytes offset of the last index chunk
+*		4 bytes total number of frames
+*		4 bytes magic "PPYE"
+*
+* The reader finds the index by following the chunks backwards from the trailer, so opening a recording only reads the
+* index chunks, never the frames. Chunking also means the writer only ever holds one chunk's worth of index in memory.
+*/
+namespace RecordingFormat
+{
+	static const uint32_t
+		FileMagic = 0x50505956, //"PPYV"
+		IndexMagic = 0x50505949, //"PPYI"
+		TrailerMagic = 0x50505945; //"PPYE"
+
+	static const int
+		Version = 1,
+		FileHeaderSizeBytes = 16,
+		IndexChunkHeaderSizeBytes = 16,
+		IndexEntrySizeBytes = 21,
+		TrailerSizeBytes = 16,
+		FramesPerIndexChunk = 256;
+
+	//Frame flags
+	static const uint8_t
+		FLAG_KEYFRAME = 1;
+
+	inline void WriteBigEndian(uint8_t* ptr, uint64_t value, int bytes) {
+		for (int i = bytes - 1; i >= 0; i--) {
+			ptr[i] = (uint8_t)(value & 0xFF);
+			value >>= 8;
+		}
+	}
+
+	inline uint64_t ReadBigEndian(const uint8_t* ptr, int bytes) {
+		uint64_t value = 0;
+		for (int i = 0; i < bytes; i++)
+			value = (value << 8) | ptr[i];
+		return value;
+	}
+}
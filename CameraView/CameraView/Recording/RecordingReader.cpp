@@ -0,0 +1,174 @@
+#include "RecordingReader.h"
+#include "..\Images\Decoder.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cassert>
+
+using namespace RecordingFormat;
+
+RecordingReader::RecordingReader(const std::string & path) : _File(path, false)
+{
+	uint8_t* data = _File.Data();
+	if (_File.Size() < FileHeaderSizeBytes || ReadBigEndian(data, 4) != FileMagic)
+		throw std::runtime_error("Not a recording: " + path);
+	if (ReadBigEndian(data + 4, 2) != Version)
+		throw std::runtime_error("Unsupported recording version: " + path);
+	_Width = (int)ReadBigEndian(data + 6, 2);
+	_Height = (int)ReadBigEndian(data + 8, 2);
+
+	ReadIndex(path);
+}
+
+RecordingReader::~RecordingReader()
+{
+}
+
+void RecordingReader::ReadIndex(const std::string& path)
+{
+	uint8_t* data = _File.Data();
+	uint64_t size = _File.Size();
+	if (size < FileHeaderSizeBytes + TrailerSizeBytes || ReadBigEndian(data + size - 4, 4) != TrailerMagic) {
+		//Not closed properly (e.g. the recorder crashed), so there's no trailer to find the index from
+		ScanFrames();
+		return;
+	}
+	uint8_t* trailer = data + size - TrailerSizeBytes;
+	uint64_t chunkOffset = ReadBigEndian(trailer, 8);
+	uint64_t frameCount = ReadBigEndian(trailer + 8, 4);
+	//Every frame has an index entry, so there can't be more frames than entries fit in the file
+	if (frameCount > size / IndexEntrySizeBytes)
+		throw std::runtime_error("Corrupt recording index: " + path);
+
+	//Walk the chunks from last to first, filling the index in from the back. Each chunk comes before the one after it,
+	//and everything it points to has to be in the file.
+	_Index.resize((size_t)frameCount);
+	int next = (int)frameCount;
+	uint64_t chunkLimit = size - TrailerSizeBytes;
+	while (chunkOffset != 0) {
+		if (chunkOffset < FileHeaderSizeBytes || chunkOffset >= chunkLimit || chunkLimit - chunkOffset < IndexChunkHeaderSizeBytes)
+			throw std::runtime_error("Corrupt recording index: " + path);
+		uint8_t* chunk = data + chunkOffset;
+		uint64_t entries = ReadBigEndian(chunk + 4, 4);
+		if (ReadBigEndian(chunk, 4) != IndexMagic || entries > (uint64_t)next ||
+			entries * IndexEntrySizeBytes > chunkLimit - chunkOffset - IndexChunkHeaderSizeBytes)
+			throw std::runtime_error("Corrupt recording index: " + path);
+
+		next -= (int)entries;
+		uint8_t* entry = chunk + IndexChunkHeaderSizeBytes;
+		for (int i = 0; i < (int)entries; i++, entry += IndexEntrySizeBytes) {
+			IndexEntry& e = _Index[next + i];
+			e.Offset = ReadBigEndian(entry, 8);
+			e.Length = (uint32_t)ReadBigEndian(entry + 8, 4);
+			e.Timestamp = (int64_t)ReadBigEndian(entry + 12, 8);
+			e.Flags = entry[20];
+			if (e.Offset < FileHeaderSizeBytes || e.Offset > size || e.Length > size - e.Offset)
+				throw std::runtime_error("Corrupt recording index: " + path);
+		}
+		chunkLimit = chunkOffset;
+		chunkOffset = ReadBigEndian(chunk + 8, 8);
+	}
+	if (next != 0)
+		throw std::runtime_error("Corrupt recording index: " + path);
+}
+
+void RecordingReader::ScanFrames()
+{
+	uint8_t* data = _File.Data();
+	uint8_t* end = data + _File.Size();
+	uint8_t* ptr = data + FileHeaderSizeBytes;
+	//The frames since the last index chunk: the next chunk, if it was written, has their timestamps
+	int unindexed = 0;
+	while (ptr < end) {
+		//A chunk is only ever written after a full chunk's worth of frames, which tells it apart from a frame
+		if (unindexed == FramesPerIndexChunk && end - ptr >= IndexChunkHeaderSizeBytes + FramesPerIndexChunk * IndexEntrySizeBytes &&
+			ReadBigEndian(ptr, 4) == IndexMagic && ReadBigEndian(ptr + 4, 4) == FramesPerIndexChunk) {
+			uint8_t* entry = ptr + IndexChunkHeaderSizeBytes;
+			for (int i = 0; i < FramesPerIndexChunk; i++, entry += IndexEntrySizeBytes)
+				_Index[_Index.size() - FramesPerIndexChunk + i].Timestamp = (int64_t)ReadBigEndian(entry + 12, 8);
+			ptr = entry;
+			unindexed = 0;
+			continue;
+		}
+
+		//Otherwise it's a frame, unless it was cut off (or isn't one -- either way, that's the end of the recording)
+		int width, height;
+		int64_t length = Decoder::SerializedSizeBytes(ptr, end - ptr);
+		if (length < 0)
+			break;
+		Decoder::ReadImageSize(ptr, &width, &height);
+		if (width != _Width || height != _Height)
+			break;
+		IndexEntry e;
+		e.Offset = (uint64_t)(ptr - data);
+		e.Length = (uint32_t)length;
+		e.Timestamp = 0;
+		e.Flags = Decoder::IsKeyframe(ptr) ? FLAG_KEYFRAME : 0;
+		_Index.push_back(e);
+		ptr += length;
+		unindexed++;
+	}
+
+	//The frames after the last chunk never had their timestamps written. Space them on from the last known one at the
+	//recording's average frame interval, or just number them if there's no index at all, so they still sort in order.
+	int indexed = (int)_Index.size() - unindexed;
+	int64_t interval = indexed > 1 ? (_Index[indexed - 1].Timestamp - _Index[0].Timestamp) / (indexed - 1) : 1;
+	for (int i = indexed; i < (int)_Index.size(); i++)
+		_Index[i].Timestamp = i > 0 ? _Index[i - 1].Timestamp + interval : 0;
+}
+
+int RecordingReader::FindFrame(int64_t timestampMicroseconds)
+{
+	//Binary search for the first frame after the timestamp, then step back one
+	auto after = std::upper_bound(_Index.begin(), _Index.end(), timestampMicroseconds,
+		[](int64_t timestamp, const IndexEntry& entry) { return timestamp < entry.Timestamp; });
+	int frame = (int)(after - _Index.begin()) - 1;
+	return frame < 0 ? 0 : frame;
+}
+
+int RecordingReader::FindKeyframe(int frame)
+{
+	for (int i = frame; i >= 0; i--)
+		if (IsKeyframe(i))
+			return i;
+	//No keyframe -- the best we can do is start from the beginning
+	return 0;
+}
+
+void RecordingReader::DecodeFrame(int frame, CompressedImage & image)
+{
+	assert(frame >= 0 && frame < FrameCount());
+
+	int start;
+	if (&image == _DecodedImage && _DecodedFrame >= 0 && _DecodedFrame < frame && FindKeyframe(frame) <= _DecodedFrame)
+		//Playing forward: carry on from what the image already holds
+		start = _DecodedFrame + 1;
+	else {
+		start = FindKeyframe(frame);
+		if (_References != nullptr)
+			_References->Reset();
+	}
+
+	for (int i = start; i <= frame; i++) {
+		int length;
+		uint8_t* data = FrameData(i, &length);
+		if (_References == nullptr && Decoder::HasReferences(data))
+			throw std::runtime_error("Recording needs long-term references to decode");
+		//The frame is only trusted once it's known to fit the image and its index entry, and to copy only references
+		//which are in the set
+		int width, height;
+		Decoder::ReadImageSize(data, &width, &height);
+		if (length < 4 || width != _Width || height != _Height ||
+			Decoder::SerializedSizeBytes(data, length, _References != nullptr ? _References->Count() : 0) != length)
+			throw std::runtime_error("Corrupt recording frame");
+		Decoder::DeserializeImage(image, data, _References);
+	}
+	_DecodedImage = &image;
+	_DecodedFrame = frame;
+}
+
+int RecordingReader::Seek(int64_t timestampMicroseconds, CompressedImage & image)
+{
+	int frame = FindFrame(timestampMicroseconds);
+	DecodeFrame(frame, image);
+	return frame;
+}
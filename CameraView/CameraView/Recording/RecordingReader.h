@@ -0,0 +1,64 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "RecordingFormat.h"
+#include "..\MappedFile.h"
+#include "..\Images\CompressedImage.h"
+#include "..\Images\ReferenceSet.h"
+
+//Plays back an indexed recording (see RecordingFormat.h). The file is memory mapped, so seeking only touches the
+//index and the frames from the nearest keyframe onwards -- never the whole file. A recording which wasn't closed (so has
+//no trailer) is scanned instead, and plays back up to its last whole frame. Recordings of streams which use long-term
+//references need a ReferenceSet with the same settings as the encoder's (see References()).
+class RecordingReader
+{
+private:
+	struct IndexEntry {
+		uint64_t Offset;
+		uint32_t Length;
+		int64_t Timestamp;
+		uint8_t Flags;
+	};
+	MappedFile _File;
+	std::vector<IndexEntry> _Index;
+	int _Width, _Height;
+	//The image DecodeFrame() last wrote to, and the frame it holds, so playing forward only decodes one frame at a time
+	CompressedImage* _DecodedImage = nullptr;
+	int _DecodedFrame = -1;
+	//The long-term references as of _DecodedFrame. Reset whenever decoding starts over from a keyframe (which the
+	//encoder's set was reset at too).
+	ReferenceSet* _References = nullptr;
+
+	void ReadIndex(const std::string& path);
+	//Rebuilds the index of a recording which wasn't closed, from the frames themselves and the index chunks in between
+	void ScanFrames();
+public:
+	inline int Width() { return _Width; }
+	inline int Height() { return _Height; }
+	inline int FrameCount() { return (int)_Index.size(); }
+	inline int64_t Timestamp(int frame) { return _Index[frame].Timestamp; }
+	inline bool IsKeyframe(int frame) { return (_Index[frame].Flags & RecordingFormat::FLAG_KEYFRAME) != 0; }
+	//Gets a frame's serialized data, pointing straight into the mapped file
+	inline uint8_t* FrameData(int frame, int* length) {
+		*length = (int)_Index[frame].Length;
+		return _File.Data() + _Index[frame].Offset;
+	}
+	//The decoder's set of long-term references, for recordings of streams which use them. It must be Width() x Height()
+	//and have the same settings as the encoder's References() -- they aren't in the recording.
+	inline ReferenceSet*& References() { return _References; }
+
+	RecordingReader(const std::string& path);
+	~RecordingReader();
+
+	//Finds the last frame at or before the timestamp (or the first frame, if the timestamp is before all of them)
+	int FindFrame(int64_t timestampMicroseconds);
+	//Finds the closest keyframe at or before a frame
+	int FindKeyframe(int frame);
+
+	//Decodes a frame into the image: forward from the nearest keyframe, or just the one frame if the image already
+	//holds the frame before it from the last call. The image must be Width() x Height().
+	void DecodeFrame(int frame, CompressedImage& image);
+	//Decodes the frame showing at the timestamp into the image and returns its index
+	int Seek(int64_t timestampMicroseconds, CompressedImage& image);
+};
@@ -0,0 +1,82 @@
+#include "RecordingWriter.h"
+#include "..\Images\Decoder.h"
+#include <stdexcept>
+#include <assert.h>
+
+using namespace RecordingFormat;
+
+RecordingWriter::RecordingWriter(const std::string & path, int width, int height)
+{
+	_File.open(path, std::ios::binary | std::ios::trunc);
+	if (!_File.is_open())
+		throw std::runtime_error("Could not create recording: " + path);
+
+	uint8_t header[FileHeaderSizeBytes] = {};
+	WriteBigEndian(header, FileMagic, 4);
+	WriteBigEndian(header + 4, Version, 2);
+	WriteBigEndian(header + 6, width, 2);
+	WriteBigEndian(header + 8, height, 2);
+	Write(header, FileHeaderSizeBytes);
+}
+
+RecordingWriter::~RecordingWriter()
+{
+	if (_File.is_open())
+		Close();
+}
+
+void RecordingWriter::Write(const uint8_t * data, size_t length)
+{
+	_File.write((const char*)data, length);
+	_Offset += length;
+}
+
+void RecordingWriter::WriteFrame(uint8_t * serializedFrame, int length, int64_t timestampMicroseconds)
+{
+	assert(timestampMicroseconds >= _LastTimestamp /*Timestamps went backwards*/);
+	_LastTimestamp = timestampMicroseconds;
+
+	uint8_t entry[IndexEntrySizeBytes];
+	WriteBigEndian(entry, _Offset, 8);
+	WriteBigEndian(entry + 8, (uint32_t)length, 4);
+	WriteBigEndian(entry + 12, (uint64_t)timestampMicroseconds, 8);
+	entry[20] = Decoder::IsKeyframe(serializedFrame) ? FLAG_KEYFRAME : 0;
+	_PendingIndex.insert(_PendingIndex.end(), entry, entry + IndexEntrySizeBytes);
+	_PendingIndexEntries++;
+	_FrameCount++;
+
+	Write(serializedFrame, length);
+
+	if (_PendingIndexEntries == FramesPerIndexChunk)
+		WriteIndexChunk();
+}
+
+void RecordingWriter::WriteIndexChunk()
+{
+	uint64_t chunkOffset = _Offset;
+
+	uint8_t header[IndexChunkHeaderSizeBytes];
+	WriteBigEndian(header, IndexMagic, 4);
+	WriteBigEndian(header + 4, (uint32_t)_PendingIndexEntries, 4);
+	WriteBigEndian(header + 8, _LastIndexChunkOffset, 8);
+	Write(header, IndexChunkHeaderSizeBytes);
+	Write(_PendingIndex.data(), _PendingIndex.size());
+
+	_LastIndexChunkOffset = chunkOffset;
+	_PendingIndex.clear();
+	_PendingIndexEntries = 0;
+}
+
+void RecordingWriter::Close()
+{
+	if (_PendingIndexEntries > 0)
+		WriteIndexChunk();
+
+	uint8_t trailer[TrailerSizeBytes];
+	WriteBigEndian(trailer, _LastIndexChunkOffset, 8);
+	WriteBigEndian(trailer + 8, (uint32_t)_FrameCount, 4);
+	WriteBigEndian(trailer + 12, TrailerMagic, 4);
+	Write(trailer, TrailerSizeBytes);
+
+	_File.close();
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include "RecordingFormat.h"
+
+//Writes serialized frames to an indexed recording (see RecordingFormat.h)
+class RecordingWriter
+{
+private:
+	std::ofstream _File;
+	//The offset the next write goes to
+	uint64_t _Offset = 0;
+	uint64_t _LastIndexChunkOffset = 0;
+	int _FrameCount = 0;
+	//The index entries not yet written out in a chunk
+	std::vector<uint8_t> _PendingIndex;
+	int _PendingIndexEntries = 0;
+	int64_t _LastTimestamp = INT64_MIN;
+
+	void Write(const uint8_t* data, size_t length);
+	void WriteIndexChunk();
+public:
+	inline int FrameCount() { return _FrameCount; }
+
+	RecordingWriter(const std::string& path, int width, int height);
+	//Closes the recording if it hasn't been already
+	~RecordingWriter();
+
+	//Appends a frame. Timestamps must not go backwards. Keyframes are detected from the frame's region table.
+	void WriteFrame(uint8_t* serializedFrame, int length, int64_t timestampMicroseconds);
+	inline void WriteFrame(std::vector<uint8_t>& serializedFrame, int64_t timestampMicroseconds) { WriteFrame(serializedFrame.data(), (int)serializedFrame.size(), timestampMicroseconds); }
+
+	//Writes the rest of the index and the trailer. The recording can't be read until this is done.
+	void Close();
+};
@@ -0,0 +1,110 @@
+#pragma once
+#include <vector>
+#include <queue>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <stdexcept>
+#include <chrono>
+#include <stdint.h>
+
+//A thread pool that runs its tasks earliest deadline first (and first come, first served among equal deadlines).
+//Shared by every image and stream so that work from many streams is interleaved on the same cores.
+//Note: never wait on a task's future from inside another task -- if every worker does so, nothing is left to run them.
+class Scheduler
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+	typedef Clock::time_point TimePoint;
+private:
+	struct Task {
+		TimePoint Deadline;
+		//Breaks ties between equal deadlines in submission order
+		uint64_t Sequence;
+		std::function<void()> Work;
+	};
+	struct TaskOrder {
+		//priority_queue puts the "largest" task on top, so this is reversed: later deadlines are smaller
+		bool operator()(const Task& a, const Task& b) const {
+			if (a.Deadline != b.Deadline) return a.Deadline > b.Deadline;
+			return a.Sequence > b.Sequence;
+		}
+	};
+
+	std::vector<std::thread> _Workers;
+	std::priority_queue<Task, std::vector<Task>, TaskOrder> _Tasks;
+	uint64_t _NextSequence = 0;
+
+	std::mutex _QueueMutex;
+	std::condition_variable _Condition;
+	bool _Stop = false;
+
+	void WorkerLoop() {
+		for (;;)
+		{
+			std::function<void()> work;
+			{
+				std::unique_lock<std::mutex> lock(_QueueMutex);
+				_Condition.wait(lock, [this] { return _Stop || !_Tasks.empty(); });
+				if (_Stop && _Tasks.empty())
+					return;
+				work = _Tasks.top().Work;
+				_Tasks.pop();
+			}
+			work();
+		}
+	}
+public:
+	Scheduler(size_t threads)
+	{
+		for (size_t i = 0; i < threads; ++i)
+			_Workers.emplace_back([this] { WorkerLoop(); });
+	}
+
+	inline int ThreadCount() { return (int)_Workers.size(); }
+
+	//Enqueues a task to be completed before the deadline. Tasks with the earliest deadline run first.
+	template<class F, class... Args> auto EnqueueBefore(TimePoint deadline, F&& f, Args&&... args)
+		->std::future<typename std::result_of<F(Args...)>::type>
+	{
+		using return_type = typename std::result_of<F(Args...)>::type;
+
+		auto task = std::make_shared< std::packaged_task<return_type()> >(
+			std::bind(std::forward<F>(f), std::forward<Args>(args)...)
+			);
+
+		std::future<return_type> res = task->get_future();
+		{
+			std::unique_lock<std::mutex> lock(_QueueMutex);
+
+			//Don't allow enqueueing after stopping the pool
+			if (_Stop)
+				throw std::runtime_error("enqueue on stopped Scheduler");
+
+			_Tasks.push(Task{ deadline, _NextSequence++, [task]() { (*task)(); } });
+		}
+		_Condition.notify_one();
+		return res;
+	}
+
+	//Enqueues a task to be run as soon as possible
+	template<class F, class... Args> auto Enqueue(F&& f, Args&&... args)
+		->std::future<typename std::result_of<F(Args...)>::type>
+	{
+		return EnqueueBefore(Clock::now(), std::forward<F>(f), std::forward<Args>(args)...);
+	}
+
+	~Scheduler()
+	{
+		{
+			std::unique_lock<std::mutex> lock(_QueueMutex);
+			_Stop = true;
+		}
+		_Condition.notify_all();
+		for (std::thread &worker : _Workers)
+			worker.join();
+	}
+};
@@ -0,0 +1,47 @@
+#include "LossyLoopback.h"
+
+LossyLoopback::LossyLoopback(double lossRate, int burstLength, unsigned int seed) : _Random(seed)
+{
+	_LossRate = lossRate;
+	_BurstLength = burstLength > 0 ? burstLength : 1;
+}
+
+LossyLoopback::~LossyLoopback()
+{
+}
+
+bool LossyLoopback::Send(const uint8_t * datagram, int length)
+{
+	if (length > MaxDatagramSize)
+		return false;
+
+	std::unique_lock<std::mutex> lock(_Mutex);
+	_Sent++;
+	//Bursts start often enough that, burstLength datagrams at a time, about lossRate of them are dropped
+	if (_BurstRemaining == 0 && std::uniform_real_distribution<double>(0, 1)(_Random) < _LossRate / _BurstLength)
+		_BurstRemaining = _BurstLength;
+	if (_BurstRemaining > 0) {
+		_BurstRemaining--;
+		_Dropped++;
+		return true;
+	}
+	_Queue.push_back(std::vector<uint8_t>(datagram, datagram + length));
+	return true;
+}
+
+bool LossyLoopback::Receive(std::vector<uint8_t>& datagram)
+{
+	std::unique_lock<std::mutex> lock(_Mutex);
+	if (_Queue.empty())
+		return false;
+	datagram = std::move(_Queue.front());
+	_Queue.pop_front();
+	return true;
+}
+
+void LossyLoopback::GetStatistics(int * sent, int * dropped)
+{
+	std::unique_lock<std::mutex> lock(_Mutex);
+	*sent = _Sent;
+	*dropped = _Dropped;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <stdint.h>
+
+//Stands in for a UDP socket over the loopback, for testing how the stream holds up to loss: datagrams sent are received
+//in order, except for the ones it drops. Losses come in bursts of a set length, as they tend to on real networks.
+//Safe to send from one thread and receive on another.
+class LossyLoopback
+{
+private:
+	std::deque<std::vector<uint8_t>> _Queue;
+	std::mutex _Mutex;
+	double _LossRate;
+	int _BurstLength;
+	int _BurstRemaining = 0;
+	std::mt19937 _Random;
+	int _Sent = 0, _Dropped = 0;
+public:
+	//The largest datagram UDP can carry
+	static const int MaxDatagramSize = 65507;
+
+	//Drops about lossRate of the datagrams (0 to 1), burstLength at a time. The seed makes runs repeatable.
+	LossyLoopback(double lossRate, int burstLength = 1, unsigned int seed = 1);
+	~LossyLoopback();
+
+	//Sends a datagram (which may well be dropped). Returns false if it's too large to send at all.
+	bool Send(const uint8_t* datagram, int length);
+	inline bool Send(const std::vector<uint8_t>& datagram) { return Send(datagram.data(), (int)datagram.size()); }
+	//Receives the next datagram that made it, if there is one
+	bool Receive(std::vector<uint8_t>& datagram);
+
+	//Gets the number of datagrams sent, and how many of them were dropped
+	void GetStatistics(int* sent, int* dropped);
+};
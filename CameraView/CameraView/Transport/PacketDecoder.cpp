@@ -0,0 +1,172 @@
+#include "PacketDecoder.h"
+#include "Packetizer.h"
+#include "..\Images\Decoder.h"
+#include <cstring>
+
+PacketDecoder::PacketDecoder(CompressedImage & image, ReferenceSet * references) : _Image(image), _References(references)
+{
+	_RegionsReceived.resize(image.RegionsWide() * image.RegionsTall(), 0);
+}
+
+PacketDecoder::~PacketDecoder()
+{
+}
+
+bool PacketDecoder::IsValid(uint8_t * packet, int length)
+{
+	if (length < Packetizer::HeaderSizeBytes)
+		return false;
+	int width, height;
+	uint8_t* header = Packetizer::FrameHeader(packet);
+	Decoder::ReadImageSize(header, &width, &height);
+	if (width != _Image.SourceWidth() || height != _Image.SourceHeight())
+		return false;
+	if (Decoder::HasReferences(header) && _References == nullptr)
+		return false;
+	int first = Packetizer::FirstRegion(packet), count = Packetizer::RegionCount(packet);
+	if (first < 0 || count <= 0 || first + count > (int)_RegionsReceived.size())
+		return false;
+	if (Packetizer::PacketIndex(packet) >= Packetizer::PacketCount(packet))
+		return false;
+
+	//Walk the regions to check they're all there
+	bool references = Decoder::HasReferences(header);
+	int tableSize = (count + 7) / 8;
+	uint8_t* end = packet + length;
+	uint8_t* regionTable = packet + Packetizer::HeaderSizeBytes;
+	uint8_t* data = regionTable + tableSize * (references ? 2 : 1);
+	if (data > end)
+		return false;
+	int presentCount = 0;
+	for (int i = 0; i < count; i++) {
+		if (regionTable[i / 8] & (1 << (i % 8)))
+			presentCount++;
+		else if (references && (regionTable[tableSize + i / 8] & (1 << (i % 8)))) {
+			//A reference the decoder's set doesn't have would be read from past the end of it
+			if (data >= end || *data >= _References->Count())
+				return false;
+			data++;
+		}
+	}
+	return Decoder::CheckRegions(data, end, presentCount, Decoder::IsAdaptive(header), Decoder::HasTemporalBlocks(header), Decoder::HasSolidBlocks(header)) == end;
+}
+
+void PacketDecoder::StartFrame(uint8_t * packet)
+{
+	uint32_t frameId = Packetizer::FrameId(packet);
+	//Frame ids in between were lost entirely
+	if (_Started) {
+		int framesLost = (int)(frameId - _FrameId) - 1;
+		_FramesLost += framesLost;
+		//Every region's references missed those frames' updates
+		if (framesLost > 0 && _References != nullptr)
+			for (int i = 0; i < (int)_RegionsReceived.size(); i++)
+				_References->LoseRegion(i % _Image.RegionsWide(), i / _Image.RegionsWide());
+	}
+
+	_Started = true;
+	_InFrame = true;
+	_FrameId = frameId;
+	_PacketCount = Packetizer::PacketCount(packet);
+	_PacketsReceived.assign(_PacketCount, 0);
+	_RegionsReceived.assign(_RegionsReceived.size(), 0);
+	_RegionsReceivedCount = 0;
+	memcpy(_FrameHeader, Packetizer::FrameHeader(packet), sizeof(_FrameHeader));
+	//Keyframes don't refer to earlier frames, and have every region (which ApplyPacket() checks)
+	_Keyframe = !Decoder::HasTemporalBlocks(_FrameHeader) && !Decoder::HasReferences(_FrameHeader);
+	Decoder::ReadFrameHeader(_Image, Packetizer::FrameHeader(packet), _References);
+}
+
+bool PacketDecoder::ApplyPacket(uint8_t * packet, int length)
+{
+	if (!IsValid(packet, length)) {
+		_PacketsDropped++;
+		return false;
+	}
+	uint32_t frameId = Packetizer::FrameId(packet);
+	//Ids wrap around, so compare the difference
+	int32_t age = (int32_t)(frameId - _FrameId);
+	if (_Started && (age < 0 || (age == 0 && !_InFrame))) {
+		//Late for a frame that's already over
+		_PacketsDropped++;
+		return false;
+	}
+	if (!_InFrame || age > 0) {
+		if (_InFrame)
+			FinishFrame();
+		StartFrame(packet);
+	}
+
+	//It was checked against its own header, but it's decoded with the frame's
+	int index = Packetizer::PacketIndex(packet);
+	if (index >= _PacketCount || _PacketsReceived[index] || memcmp(Packetizer::FrameHeader(packet), _FrameHeader, sizeof(_FrameHeader)) != 0) {
+		_PacketsDropped++;
+		return false;
+	}
+	_PacketsReceived[index] = 1;
+
+	int first = Packetizer::FirstRegion(packet), count = Packetizer::RegionCount(packet);
+	int tableSize = (count + 7) / 8;
+	uint8_t* regionTable = packet + Packetizer::HeaderSizeBytes;
+	uint8_t* referenceTable = nullptr;
+	uint8_t* data = regionTable + tableSize;
+	uint8_t* referenceNumbers = nullptr;
+	if (_Image.References()) {
+		referenceTable = data;
+		referenceNumbers = data += tableSize;
+		for (int i = 0; i < count; i++)
+			if (referenceTable[i / 8] & (1 << (i % 8)))
+				data++;
+	}
+	for (int i = 0; i < count && _Keyframe; i++)
+		if ((regionTable[i / 8] & (1 << (i % 8))) == 0)
+			_Keyframe = false;
+	Decoder::DeserializeRegions(_Image, first, count, regionTable, referenceTable, referenceNumbers, data, _References);
+	for (int i = first; i < first + count; i++)
+		_RegionsReceived[i] = 1;
+	_RegionsReceivedCount += count;
+
+	//Everything's in
+	for (int i = 0; i < _PacketCount; i++)
+		if (!_PacketsReceived[i])
+			return false;
+	FinishFrame();
+	return true;
+}
+
+void PacketDecoder::FinishFrame()
+{
+	if (!_InFrame)
+		return;
+	_InFrame = false;
+
+	int packetsLost = 0;
+	for (int i = 0; i < _PacketCount; i++)
+		if (!_PacketsReceived[i])
+			packetsLost++;
+	if (packetsLost == 0) {
+		_FramesComplete++;
+		//The encoder's references were reset at it too, so every row is back in step
+		if (_Keyframe && _References != nullptr)
+			_References->Reset();
+		return;
+	}
+	_FramesDamaged++;
+	_PacketsLost += packetsLost;
+	_RegionsLost += (int64_t)_RegionsReceived.size() - _RegionsReceivedCount;
+	//The lost regions' references missed their updates
+	if (_References != nullptr)
+		for (int i = 0; i < (int)_RegionsReceived.size(); i++)
+			if (!_RegionsReceived[i])
+				_References->LoseRegion(i % _Image.RegionsWide(), i / _Image.RegionsWide());
+}
+
+void PacketDecoder::GetStatistics(int * framesComplete, int * framesDamaged, int * framesLost, int * packetsLost, int * packetsDropped, int64_t * regionsLost)
+{
+	*framesComplete = _FramesComplete;
+	*framesDamaged = _FramesDamaged;
+	*framesLost = _FramesLost;
+	*packetsLost = _PacketsLost;
+	*packetsDropped = _PacketsDropped;
+	*regionsLost = _RegionsLost;
+}
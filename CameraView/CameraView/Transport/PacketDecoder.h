@@ -0,0 +1,68 @@
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include "..\Images\CompressedImage.h"
+#include "..\Images\ReferenceSet.h"
+
+//Applies the packets of a stream (see Packetizer) to an image as they arrive, in whatever order.
+//
+//Every packet's regions are decoded as soon as it comes in. A frame ends once all of its packets are in, or when a
+//packet of a later frame arrives; the regions of any packets which didn't make it are left as they were in the previous
+//frame. Packets of frames which have already ended are dropped, as are packets which are cut short or don't fit the image.
+//
+//A lost region leaves the decoder's copy of it out of step with the encoder's until it's sent again, so a damaged frame
+//is the cue to ask the encoder for a keyframe (or to rely on its intra refresh).
+//
+//With long-term references, a lost region (or frame) also leaves its references out of step, which intra refresh
+//doesn't fix. The region stops using them (a copy from them is kept as it was, like a lost region) until a keyframe
+//comes in whole, so streams with references need keyframes: at an interval, or asked for.
+class PacketDecoder
+{
+private:
+	CompressedImage& _Image;
+	ReferenceSet* _References;
+
+	//The frame being received (or the last one, once it's over)
+	bool _Started = false;
+	bool _InFrame = false;
+	uint32_t _FrameId = 0;
+	//The frame header of the packet which started the frame. The image's flags come from it, so every other packet of
+	//the frame must have the same.
+	uint8_t _FrameHeader[4] = {};
+	int _PacketCount = 0;
+	std::vector<char> _PacketsReceived;
+	//Which regions the frame's packets have covered
+	std::vector<char> _RegionsReceived;
+	int _RegionsReceivedCount = 0;
+	//Whether the frame is a keyframe, as far as its packets so far show
+	bool _Keyframe = false;
+
+	//Statistics
+	int _FramesComplete = 0, _FramesDamaged = 0, _FramesLost = 0;
+	int _PacketsLost = 0, _PacketsDropped = 0;
+	int64_t _RegionsLost = 0;
+
+	//Whether a packet is whole and its regions are within the image
+	bool IsValid(uint8_t* packet, int length);
+	void StartFrame(uint8_t* packet);
+public:
+	//Decodes onto the image, which holds the previous frame. Streams which use long-term references need the decoder's
+	//set of them.
+	PacketDecoder(CompressedImage& image, ReferenceSet* references = nullptr);
+	~PacketDecoder();
+
+	inline CompressedImage& Image() { return _Image; }
+	//Whether a frame has been started and not ended yet
+	inline bool InFrame() { return _InFrame; }
+	inline uint32_t FrameId() { return _FrameId; }
+
+	//Applies a packet. Returns whether it was the last one of its frame, i.e. the frame is whole and ready to show.
+	bool ApplyPacket(uint8_t* packet, int length);
+	//Gives up on the rest of the frame being received (e.g. once it's due to be shown). The image has the regions that
+	//came in.
+	void FinishFrame();
+
+	//Gets the number of frames which came in whole, with packets missing, and not at all (frame ids skipped over); the
+	//number of packets that never came and that were dropped; and the number of regions lost with the missing packets
+	void GetStatistics(int* framesComplete, int* framesDamaged, int* framesLost, int* packetsLost, int* packetsDropped, int64_t* regionsLost);
+};
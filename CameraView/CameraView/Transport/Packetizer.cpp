@@ -0,0 +1,139 @@
+#include "Packetizer.h"
+#include "..\Images\Decoder.h"
+#include <cassert>
+#include <cstring>
+
+static void WriteUInt32(uint8_t* ptr, uint32_t value)
+{
+	ptr[0] = (uint8_t)(value >> 24);
+	ptr[1] = (uint8_t)(value >> 16);
+	ptr[2] = (uint8_t)(value >> 8);
+	ptr[3] = (uint8_t)value;
+}
+
+static void WriteUInt16(uint8_t* ptr, uint16_t value)
+{
+	ptr[0] = (uint8_t)(value >> 8);
+	ptr[1] = (uint8_t)value;
+}
+
+static inline bool GetBit(const uint8_t* table, int i) { return (table[i / 8] & (1 << (i % 8))) != 0; }
+
+Packetizer::Packetizer()
+{
+}
+
+Packetizer::~Packetizer()
+{
+}
+
+std::vector<std::vector<uint8_t>> Packetizer::Packetize(uint8_t * serializedFrame, uint32_t frameId, int maxPacketSize)
+{
+	assert(maxPacketSize >= MinPacketSize);
+	int width, height;
+	Decoder::ReadImageSize(serializedFrame, &width, &height);
+	bool adaptive = Decoder::IsAdaptive(serializedFrame), temporalBlocks = Decoder::HasTemporalBlocks(serializedFrame), solidBlocks = Decoder::HasSolidBlocks(serializedFrame);
+	bool references = Decoder::HasReferences(serializedFrame);
+	int regionCount = ((width + Region::Width - 1) / Region::Width) * ((height + Region::Height - 1) / Region::Height);
+
+	//Find where everything is in the frame
+	uint8_t* regionTable = serializedFrame + 4;
+	uint8_t* data = regionTable + (regionCount + 7) / 8;
+	uint8_t* referenceTable = nullptr;
+	uint8_t* referenceNumbers = nullptr;
+	if (references) {
+		referenceTable = data;
+		referenceNumbers = data += (regionCount + 7) / 8;
+		for (int i = 0; i < regionCount; i++)
+			if (GetBit(referenceTable, i))
+				data++;
+	}
+	//Where each region's data starts (the next one's start is its end), and where each one's reference number is
+	std::vector<uint8_t*> regionData(regionCount + 1);
+	std::vector<uint8_t*> regionReference(regionCount + 1);
+	for (int i = 0; i < regionCount; i++) {
+		regionData[i] = data;
+		regionReference[i] = referenceNumbers;
+		if (GetBit(regionTable, i))
+			data += Decoder::RegionSizeBytes(data, adaptive, temporalBlocks, solidBlocks);
+		else if (references && GetBit(referenceTable, i))
+			referenceNumbers++;
+	}
+	regionData[regionCount] = data;
+	regionReference[regionCount] = referenceNumbers;
+
+	std::vector<std::vector<uint8_t>> packets;
+	int first = 0;
+	while (first < regionCount) {
+		//Take as many regions as will fit
+		int count = 0;
+		int tableCount = references ? 2 : 1;
+		while (first + count < regionCount && count < 0xFFFF) {
+			int next = first + count + 1;
+			int size = HeaderSizeBytes + (count + 1 + 7) / 8 * tableCount + (int)(regionReference[next] - regionReference[first]) + (int)(regionData[next] - regionData[first]);
+			if (size > maxPacketSize)
+				break;
+			count++;
+		}
+		assert(count > 0 /*A region doesn't fit in a packet*/);
+
+		int tableSize = (count + 7) / 8;
+		int referenceBytes = (int)(regionReference[first + count] - regionReference[first]);
+		int dataBytes = (int)(regionData[first + count] - regionData[first]);
+		std::vector<uint8_t> packet(HeaderSizeBytes + tableSize * tableCount + referenceBytes + dataBytes, 0);
+		WriteUInt32(&packet[0], frameId);
+		WriteUInt16(&packet[4], (uint16_t)packets.size());
+		memcpy(&packet[8], serializedFrame, 4);
+		WriteUInt32(&packet[12], (uint32_t)first);
+		WriteUInt16(&packet[16], (uint16_t)count);
+
+		//The tables are copied a bit at a time, as the run rarely starts on a byte
+		uint8_t* ptr = &packet[HeaderSizeBytes];
+		for (int i = 0; i < count; i++)
+			if (GetBit(regionTable, first + i))
+				ptr[i / 8] |= 1 << (i % 8);
+		ptr += tableSize;
+		if (references) {
+			for (int i = 0; i < count; i++)
+				if (GetBit(referenceTable, first + i))
+					ptr[i / 8] |= 1 << (i % 8);
+			ptr += tableSize;
+			memcpy(ptr, regionReference[first], referenceBytes);
+			ptr += referenceBytes;
+		}
+		memcpy(ptr, regionData[first], dataBytes);
+
+		packets.push_back(std::move(packet));
+		first += count;
+	}
+
+	//Now that the count is known
+	for (auto& packet : packets)
+		WriteUInt16(&packet[6], (uint16_t)packets.size());
+	return packets;
+}
+
+uint32_t Packetizer::FrameId(const uint8_t * packet)
+{
+	return ((uint32_t)packet[0] << 24) | ((uint32_t)packet[1] << 16) | ((uint32_t)packet[2] << 8) | packet[3];
+}
+
+int Packetizer::PacketIndex(const uint8_t * packet)
+{
+	return (packet[4] << 8) | packet[5];
+}
+
+int Packetizer::PacketCount(const uint8_t * packet)
+{
+	return (packet[6] << 8) | packet[7];
+}
+
+int Packetizer::FirstRegion(const uint8_t * packet)
+{
+	return (int)(((uint32_t)packet[12] << 24) | ((uint32_t)packet[13] << 16) | ((uint32_t)packet[14] << 8) | packet[15]);
+}
+
+int Packetizer::RegionCount(const uint8_t * packet)
+{
+	return (packet[16] << 8) | packet[17];
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <vector>
+#include <stdint.h>
+
+//Splits serialized frames into packets small enough to go over the network unfragmented (e.g. UDP datagrams).
+//
+//Each packet holds a run of whole regions, and everything needed to decode them on their own: a lost packet only
+//loses its regions, which the decoder keeps from the previous frame (see PacketDecoder). Packets are laid out as such,
+//big endian:
+//	4 bytes frame id
+//	2 bytes packet index, 2 bytes packet count (of the frame)
+//	4 bytes frame header (the serialized frame's size and flags)
+//	4 bytes first region index, 2 bytes region count
+//	The run's part of the region table (1 bit per region, first region in bit 0), then of the reference table and the
+//	reference numbers if the frame has them, then the run's region data -- the same as in a whole frame.
+//Every region is in a packet, present or not, so the decoder sees the whole frame when no packet is lost.
+class Packetizer
+{
+private:
+	Packetizer();
+	~Packetizer();
+public:
+	static const int
+		HeaderSizeBytes = 18,
+		//Fits in an Ethernet frame with room for the IP and UDP headers (and then some, for tunnels)
+		DefaultMaxPacketSize = 1200,
+		//The smallest packet that fits the largest region
+		MinPacketSize = 560;
+
+	//Splits a serialized frame into packets of no more than maxPacketSize bytes
+	static std::vector<std::vector<uint8_t>> Packetize(uint8_t* serializedFrame, uint32_t frameId, int maxPacketSize = DefaultMaxPacketSize);
+
+	//Reads the fields of a packet's header
+	static uint32_t FrameId(const uint8_t* packet);
+	static int PacketIndex(const uint8_t* packet);
+	static int PacketCount(const uint8_t* packet);
+	static int FirstRegion(const uint8_t* packet);
+	static int RegionCount(const uint8_t* packet);
+	//The frame header within the packet, which the decoder reads as it would a whole frame's
+	static inline uint8_t* FrameHeader(uint8_t* packet) { return packet + 8; }
+};
@@ -0,0 +1,90 @@
+#include "SharedMemoryRing.h"
+#include <stdexcept>
+#include <new>
+
+SharedMemoryRing::SharedMemoryRing(const std::string & path, uint32_t capacity)
+{
+	_Capacity = (capacity + 7) & ~7u;
+	_File.reset(new MappedFile(path, (size_t)HeaderSizeBytes + _Capacity));
+
+	//Construct the header in place
+	_Header = new (_File->Data()) Header();
+	_Header->Capacity = _Capacity;
+	_Header->WritePosition.store(0);
+	_Header->ReadPosition.store(0);
+	_Header->Magic = RingMagic;
+	_Ring = _File->Data() + HeaderSizeBytes;
+}
+
+SharedMemoryRing::SharedMemoryRing(const std::string & path)
+{
+	_File.reset(new MappedFile(path, true));
+
+	_Header = (Header*)_File->Data();
+	if (_File->Size() < HeaderSizeBytes || _Header->Magic != RingMagic)
+		throw std::runtime_error("Not a shared memory ring: " + path);
+	_Capacity = _Header->Capacity;
+	_Ring = _File->Data() + HeaderSizeBytes;
+}
+
+SharedMemoryRing::~SharedMemoryRing()
+{
+}
+
+uint8_t * SharedMemoryRing::BeginWrite(uint32_t maxLength)
+{
+	if (maxLength > MaxFrameSize())
+		throw std::runtime_error("Frame is too large for the ring");
+
+	uint64_t write = _Header->WritePosition.load(std::memory_order_relaxed);
+	uint64_t read = _Header->ReadPosition.load(std::memory_order_acquire);
+	uint32_t offset = (uint32_t)(write % _Capacity);
+	uint32_t needed = RecordSize(maxLength);
+
+	//Frames are never split: skip the rest of the ring if the frame won't fit before the end
+	uint32_t skipped = offset + needed > _Capacity ? _Capacity - offset : 0;
+	if (_Capacity - (write - read) < skipped + needed)
+		return nullptr;
+
+	if (skipped > 0) {
+		//The space is not published until CommitWrite(), so the reader can't see the marker early
+		*(uint32_t*)(_Ring + offset) = WrapMarker;
+		offset = 0;
+	}
+	_PendingPosition = write + skipped;
+	return _Ring + offset + RecordHeaderSizeBytes;
+}
+
+void SharedMemoryRing::CommitWrite(uint32_t length)
+{
+	*(uint32_t*)(_Ring + _PendingPosition % _Capacity) = length;
+	//Release: the frame's bytes are visible before the position that publishes them
+	_Header->WritePosition.store(_PendingPosition + RecordSize(length), std::memory_order_release);
+}
+
+uint8_t * SharedMemoryRing::BeginRead(uint32_t * length)
+{
+	uint64_t read = _Header->ReadPosition.load(std::memory_order_relaxed);
+	uint64_t write = _Header->WritePosition.load(std::memory_order_acquire);
+	if (read == write)
+		return nullptr;
+
+	uint32_t offset = (uint32_t)(read % _Capacity);
+	uint32_t recordLength = *(uint32_t*)(_Ring + offset);
+	if (recordLength == WrapMarker) {
+		//The frame starts back at the beginning of the ring
+		read += _Capacity - offset;
+		offset = 0;
+		recordLength = *(uint32_t*)_Ring;
+	}
+
+	_PendingPosition = read;
+	_PendingLength = recordLength;
+	*length = recordLength;
+	return _Ring + offset + RecordHeaderSizeBytes;
+}
+
+void SharedMemoryRing::EndRead()
+{
+	_Header->ReadPosition.store(_PendingPosition + RecordSize(_PendingLength), std::memory_order_release);
+}
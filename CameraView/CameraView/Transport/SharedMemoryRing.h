@@ -0,0 +1,70 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+#include <memory>
+#include "..\MappedFile.h"
+
+//A single producer, single consumer ring of serialized frames in a memory mapped file, for passing frames between
+//processes on the same machine without copying them through a socket or a pipe.
+//
+//The file starts with a header holding the write and read positions, followed by the ring itself. Each frame is
+//stored as an 8 byte record header (the frame's length) followed by the frame, padded to 8 bytes. A frame is never
+//split across the end of the ring -- if it won't fit, a wrap marker is written and it starts back at the beginning --
+//so the reader always gets a frame as one contiguous run of bytes it can deserialize in place.
+//
+//The positions only ever increase (the offset in the ring is position % capacity) and each side only ever writes its
+//own, so no locks are needed: the producer publishes a frame by bumping the write position, and the consumer frees
+//it by bumping the read position.
+class SharedMemoryRing
+{
+private:
+	struct Header {
+		uint32_t Magic;
+		uint32_t Capacity;
+		//Each position gets its own cache line so the producer and consumer don't fight over it
+		alignas(64) std::atomic<uint64_t> WritePosition;
+		alignas(64) std::atomic<uint64_t> ReadPosition;
+	};
+	static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Ring positions must be lock free to be shared between processes");
+
+	static const uint32_t RingMagic = 0x52595050; //"PPYR"
+	static const uint32_t WrapMarker = 0xFFFFFFFF;
+	static const int RecordHeaderSizeBytes = 8;
+	static const int HeaderSizeBytes = 192;
+	static_assert(sizeof(Header) <= HeaderSizeBytes, "Ring header does not fit");
+
+	Header* _Header = nullptr;
+	uint8_t* _Ring = nullptr;
+	uint32_t _Capacity = 0;
+	//The position of the frame between BeginWrite()/CommitWrite() or BeginRead()/EndRead()
+	uint64_t _PendingPosition = 0;
+	uint32_t _PendingLength = 0;
+
+	std::unique_ptr<MappedFile> _File;
+
+	inline static uint32_t RecordSize(uint32_t length) { return RecordHeaderSizeBytes + ((length + 7) & ~7u); }
+public:
+	//Creates (or overwrites) the ring file. Done by the producer. The capacity is rounded up to a multiple of 8 bytes.
+	SharedMemoryRing(const std::string& path, uint32_t capacity);
+	//Opens a ring file which was already created. Done by the consumer.
+	SharedMemoryRing(const std::string& path);
+	~SharedMemoryRing();
+
+	inline uint32_t Capacity() { return _Capacity; }
+	//The largest frame that can ever be written to the ring
+	inline uint32_t MaxFrameSize() { return _Capacity / 2 - RecordHeaderSizeBytes; }
+
+	//Producer: reserves space for a frame of up to maxLength bytes and returns where to write it (e.g. with
+	//Encoder::EncodeImage()), or nullptr if the ring is too full because the consumer has fallen behind.
+	uint8_t* BeginWrite(uint32_t maxLength);
+	//Producer: publishes the frame reserved by BeginWrite(), with its actual length
+	void CommitWrite(uint32_t length);
+
+	//Consumer: returns the oldest unread frame (pointing into the mapping -- pass it straight to
+	//Decoder::DeserializeImage()), or nullptr if there isn't one
+	uint8_t* BeginRead(uint32_t* length);
+	//Consumer: frees the frame returned by BeginRead() so the producer can reuse the space
+	void EndRead();
+};
@@ -0,0 +1,237 @@
+#include "TransportBenchmark.h"
+#include "SharedMemoryRing.h"
+#include "Packetizer.h"
+#include "PacketDecoder.h"
+#include "LossyLoopback.h"
+#include "..\Images\StreamEncoder.h"
+#include "..\Images\Decoder.h"
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#define PipeCreate(fds) _pipe(fds, 1 << 20, _O_BINARY)
+#define PipeWrite _write
+#define PipeRead _read
+#define PipeClose _close
+#else
+#include <unistd.h>
+#define PipeCreate(fds) pipe(fds)
+#define PipeWrite write
+#define PipeRead read
+#define PipeClose close
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+//Builds a set of realistically sized frames: a keyframe, then mostly-static frames with a moving square
+static std::vector<std::vector<uint8_t>> BuildFrames(int width, int height, int count, bool intraRefresh = false)
+{
+	std::vector<BGRColor> colors(width * height);
+	StreamEncoder encoder(width, height);
+	encoder.IntraRefresh() = intraRefresh;
+	std::vector<std::vector<uint8_t>> frames;
+	for (int i = 0; i < count; i++) {
+		for (int y = 0; y < height; y++)
+			for (int x = 0; x < width; x++) {
+				bool inSquare = x >= i * 8 % width && x < i * 8 % width + 128 && y >= 200 && y < 328;
+				colors[y * width + x] = inSquare ? BGRColor(255, 40, 40) : BGRColor(x & 0xFF, y & 0xFF, (x + y) & 0xFF);
+			}
+		frames.push_back(encoder.EncodeFrame(colors.data()));
+	}
+	return frames;
+}
+
+static void PrintResults(std::ostream& out, const char* name, bool paced, std::vector<double>& latencies, size_t bytes, double seconds)
+{
+	if (!paced) {
+		out << name << " throughput: " << latencies.size() / seconds << " frames/s, " << bytes / seconds / 1024 / 1024 << " mb/s\n";
+		return;
+	}
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&](double p) { return latencies[(size_t)(p * (latencies.size() - 1))] * 1e6; };
+	out << name << " latency (us): p50 " << percentile(0.5) << ", p99 " << percentile(0.99) << ", p99.9 " << percentile(0.999) << ", max " << percentile(1) << "\n";
+}
+
+//When paced, the producer waits for each frame to be consumed before sending the next, so the latency measured is the
+//transport's own rather than time spent queued behind other frames. Unpaced runs measure throughput.
+static void WaitForConsumer(bool paced, std::atomic<size_t>& consumed, size_t frame)
+{
+	while (paced && consumed.load() < frame)
+		std::this_thread::yield();
+}
+
+static void BenchmarkRing(std::ostream& out, std::vector<std::vector<uint8_t>>& frames, int width, int height, bool paced)
+{
+	const char* path = "transport_benchmark.ring";
+	SharedMemoryRing producerRing(path, 16 * 1024 * 1024);
+	SharedMemoryRing consumerRing(path);
+	std::vector<Clock::time_point> sent(frames.size());
+	std::vector<double> latencies(frames.size());
+	size_t bytes = 0;
+	std::atomic<size_t> consumed(0);
+
+	auto start = Clock::now();
+	std::thread consumer([&] {
+		CompressedImage image(width, height);
+		for (size_t i = 0; i < frames.size(); i++) {
+			uint32_t length;
+			uint8_t* frame;
+			while ((frame = consumerRing.BeginRead(&length)) == nullptr)
+				std::this_thread::yield();
+			//Zero copies: decode straight out of the mapping
+			Decoder::DeserializeImage(image, frame);
+			consumerRing.EndRead();
+			latencies[i] = std::chrono::duration<double>(Clock::now() - sent[i]).count();
+			consumed++;
+		}
+	});
+	for (size_t i = 0; i < frames.size(); i++) {
+		WaitForConsumer(paced, consumed, i);
+		uint8_t* buffer;
+		while ((buffer = producerRing.BeginWrite((uint32_t)frames[i].size())) == nullptr)
+			std::this_thread::yield();
+		sent[i] = Clock::now();
+		//Stands in for the encoder serializing straight into the ring
+		memcpy(buffer, frames[i].data(), frames[i].size());
+		producerRing.CommitWrite((uint32_t)frames[i].size());
+		bytes += frames[i].size();
+	}
+	consumer.join();
+
+	PrintResults(out, "Shared memory ring", paced, latencies, bytes, std::chrono::duration<double>(Clock::now() - start).count());
+	remove(path);
+}
+
+static void BenchmarkPipe(std::ostream& out, std::vector<std::vector<uint8_t>>& frames, int width, int height, bool paced)
+{
+	int fds[2];
+	if (PipeCreate(fds) != 0) {
+		out << "Could not create pipe\n";
+		return;
+	}
+	std::vector<Clock::time_point> sent(frames.size());
+	std::vector<double> latencies(frames.size());
+	size_t bytes = 0;
+	std::atomic<size_t> consumed(0);
+
+	//Reads exactly count bytes from the pipe
+	auto readAll = [](int fd, uint8_t* data, size_t count) {
+		while (count > 0) {
+			int received = (int)PipeRead(fd, data, (unsigned int)count);
+			if (received <= 0) return false;
+			data += received;
+			count -= received;
+		}
+		return true;
+	};
+
+	auto start = Clock::now();
+	std::thread consumer([&] {
+		CompressedImage image(width, height);
+		std::vector<uint8_t> buffer;
+		for (size_t i = 0; i < frames.size(); i++) {
+			uint32_t length;
+			if (!readAll(fds[0], (uint8_t*)&length, sizeof(length))) return;
+			buffer.resize(length);
+			if (!readAll(fds[0], buffer.data(), length)) return;
+			Decoder::DeserializeImage(image, buffer.data());
+			latencies[i] = std::chrono::duration<double>(Clock::now() - sent[i]).count();
+			consumed++;
+		}
+	});
+	for (size_t i = 0; i < frames.size(); i++) {
+		WaitForConsumer(paced, consumed, i);
+		uint32_t length = (uint32_t)frames[i].size();
+		sent[i] = Clock::now();
+		PipeWrite(fds[1], &length, sizeof(length));
+		for (size_t written = 0; written < length;) {
+			int result = (int)PipeWrite(fds[1], frames[i].data() + written, (unsigned int)(length - written));
+			if (result <= 0) break;
+			written += result;
+		}
+		bytes += length;
+	}
+	consumer.join();
+	PipeClose(fds[0]);
+	PipeClose(fds[1]);
+
+	PrintResults(out, "Pipe", paced, latencies, bytes, std::chrono::duration<double>(Clock::now() - start).count());
+}
+
+void RunTransportBenchmark(std::ostream& out, int frameCount)
+{
+	int width = 1280, height = 720;
+	out << "Encoding " << frameCount << " " << width << "x" << height << " frames...\n";
+	auto frames = BuildFrames(width, height, frameCount);
+
+	for (int paced = 0; paced < 2; paced++) {
+		BenchmarkRing(out, frames, width, height, paced != 0);
+		BenchmarkPipe(out, frames, width, height, paced != 0);
+	}
+}
+
+void RunLossBenchmark(std::ostream& out, int frameCount, double lossRate, int burstLength)
+{
+	int width = 1280, height = 720;
+	out << "Encoding " << frameCount << " " << width << "x" << height << " frames (with intra refresh)...\n";
+	auto frames = BuildFrames(width, height, frameCount, true);
+
+	LossyLoopback loopback(lossRate, burstLength);
+	CompressedImage lossless(width, height), packetized(width, height), wholeFrames(width, height);
+	PacketDecoder decoder(packetized);
+	std::vector<BGRColor> expected(width * height), actual(width * height);
+	int64_t packetWrongPixels = 0, frameWrongPixels = 0;
+	size_t packetCount = 0;
+
+	//The fraction of the picture which is off from the lossless decode
+	auto wrongPixels = [&](CompressedImage& image) {
+		Decoder::DecodeImageToBGRArray(image, actual.data(), width, height);
+		int64_t wrong = 0;
+		for (int i = 0; i < width * height; i++)
+			if (memcmp(&expected[i], &actual[i], sizeof(BGRColor)) != 0)
+				wrong++;
+		return wrong;
+	};
+
+	std::vector<uint8_t> datagram;
+	for (size_t i = 0; i < frames.size(); i++) {
+		Decoder::DeserializeImage(lossless, frames[i].data());
+		Decoder::DecodeImageToBGRArray(lossless, expected.data(), width, height);
+
+		auto packets = Packetizer::Packetize(frames[i].data(), (uint32_t)i);
+		packetCount += packets.size();
+		int sentBefore, droppedBefore, sentAfter, droppedAfter;
+		loopback.GetStatistics(&sentBefore, &droppedBefore);
+		for (auto& packet : packets) {
+			loopback.Send(packet);
+			//Received straight away, as over the loopback
+			while (loopback.Receive(datagram))
+				decoder.ApplyPacket(datagram.data(), (int)datagram.size());
+		}
+		//Whatever didn't make it won't now
+		decoder.FinishFrame();
+		packetWrongPixels += wrongPixels(packetized);
+
+		//Sent as one blob, a frame is lost with any of its packets
+		loopback.GetStatistics(&sentAfter, &droppedAfter);
+		if (droppedAfter == droppedBefore)
+			Decoder::DeserializeImage(wholeFrames, frames[i].data());
+		frameWrongPixels += wrongPixels(wholeFrames);
+	}
+
+	int sent, dropped, framesComplete, framesDamaged, framesLost, packetsLost, packetsDropped;
+	int64_t regionsLost;
+	loopback.GetStatistics(&sent, &dropped);
+	decoder.GetStatistics(&framesComplete, &framesDamaged, &framesLost, &packetsLost, &packetsDropped, &regionsLost);
+	double totalPixels = (double)width * height * frames.size();
+	out << sent << " packets (" << (double)packetCount / frames.size() << " per frame), " << dropped << " dropped\n";
+	out << "Packets: " << framesComplete << " frames whole, " << framesDamaged << " damaged, " << framesLost << " lost, " << regionsLost << " regions lost; ";
+	out << packetWrongPixels * 100.0 / totalPixels << "% of pixels wrong\n";
+	out << "Whole frames: " << frameWrongPixels * 100.0 / totalPixels << "% of pixels wrong\n";
+}
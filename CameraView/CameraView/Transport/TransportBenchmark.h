@@ -0,0 +1,10 @@
+#pragma once
+#include <ostream>
+
+//Compares passing serialized frames between a producer and a consumer through a SharedMemoryRing versus a pipe.
+//The consumer deserializes every frame it receives. Prints the throughput and the latency percentiles of each.
+void RunTransportBenchmark(std::ostream& out, int frameCount);
+
+//Sends a stream through a LossyLoopback, both as packets (see Packetizer) and as whole frames which are lost if any of
+//their packets are, and prints how much of the picture each gets wrong compared to a lossless decode.
+void RunLossBenchmark(std::ostream& out, int frameCount, double lossRate, int burstLength);
@@ -7,6 +7,14 @@
 #include <ctime>
 #include "Images\Decoder.h"
 #include "Images\ImageDiff.h"
+#include "Images\StreamEncoder.h"
+#include "Images\LookaheadEncoder.h"
+#include "Images\BatchEncoder.h"
+#include "Images\AsyncDecoder.h"
+#include "Recording\RecordingReader.h"
+#include "Recording\RecordingWriter.h"
+#include "Transport\TransportBenchmark.h"
+#include "Kernels\Kernels.h"
 #include <fstream>
 
 int ErrorAndExit(std::string str)
@@ -60,8 +68,72 @@ void Print(std::string data, cv::Mat frame) {
 	}
 }
 
-int main()
+//Re-encodes a recording, either with a lookahead window (smaller, for archiving) or in batches of frames built all at
+//once (faster, for bulk conversions)
+void TranscodeRecording(const std::string& inputPath, const std::string& outputPath, bool lookahead)
 {
+	RecordingReader reader(inputPath);
+	//Recordings are made with the encoders' default reference settings
+	ReferenceSet references(reader.Width(), reader.Height());
+	reader.References() = &references;
+	RecordingWriter writer(outputPath, reader.Width(), reader.Height());
+	CompressedImage image(reader.Width(), reader.Height());
+	std::vector<BGRColor> pixels(reader.Width() * reader.Height());
+	//Frames come out of the lookahead in order, so their timestamps are taken in order too
+	int written = 0;
+	auto onFrameEncoded = [&](std::vector<uint8_t>& serializedFrame) {
+		writer.WriteFrame(serializedFrame, reader.Timestamp(written++));
+	};
+	//A 1 second window at 30 fps
+	std::unique_ptr<LookaheadEncoder> lookaheadEncoder(lookahead ? new LookaheadEncoder(reader.Width(), reader.Height(), 30, onFrameEncoded) : nullptr);
+	std::unique_ptr<BatchEncoder> batchEncoder(lookahead ? nullptr : new BatchEncoder(reader.Width(), reader.Height(), onFrameEncoded));
+	if (lookahead)
+		lookaheadEncoder->KeyframeInterval() = 300;
+	else
+		batchEncoder->Encoder().KeyframeInterval() = 300;
+	for (int i = 0; i < reader.FrameCount(); i++) {
+		reader.DecodeFrame(i, image);
+		Decoder::DecodeImageToBGRArray(image, pixels.data(), reader.Width(), reader.Height());
+		if (lookahead)
+			lookaheadEncoder->SubmitFrame(pixels.data());
+		else
+			batchEncoder->SubmitFrame(pixels.data());
+	}
+	if (lookahead)
+		lookaheadEncoder->Flush();
+	else
+		batchEncoder->Flush();
+	writer.Close();
+	std::cout << "Transcoded " << written << " frames\n";
+}
+
+int main(int argc, char** argv)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		//Forces the SIMD level, e.g. --simd=sse4.1 (same as the CAMERAVIEW_SIMD environment variable)
+		Kernels::Level level;
+		if (arg.compare(0, 7, "--simd=") == 0 && Kernels::ParseLevel(arg.c_str() + 7, &level))
+			Kernels::SetLevel(level);
+	}
+	std::cout << "SIMD: " << Kernels::LevelName(Kernels::ActiveLevel()) << " (supported: " << Kernels::LevelName(Kernels::SupportedLevel()) << ")\n";
+
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-transport") {
+		RunTransportBenchmark(std::cout, 2000);
+		return 0;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-loss") {
+		//2% loss, in bursts of 2 packets
+		RunLossBenchmark(std::cout, 300, 0.02, 2);
+		return 0;
+	}
+
+	//--transcode <input recording> <output recording>, and --batch-transcode for the faster batched one
+	if (argc > 3 && (std::string(argv[1]) == "--transcode" || std::string(argv[1]) == "--batch-transcode")) {
+		TranscodeRecording(argv[2], argv[3], std::string(argv[1]) == "--transcode");
+		return 0;
+	}
+
 	auto windowName = "Camera";
 	cvNamedWindow(windowName, CV_WINDOW_AUTOSIZE);
 	cv::VideoCapture capture;
@@ -73,11 +145,21 @@ int main()
 	int width = (int)capture.get(CV_CAP_PROP_FRAME_WIDTH),
 		height = (int)capture.get(CV_CAP_PROP_FRAME_HEIGHT);
 
-	CompressedImage* img = new CompressedImage(width, height);
-	CompressedImage* prev = new CompressedImage(width, height);
-
 	double durationSecs = 10;
 	bool temporalDeduplication = true;
+	StreamEncoder encoder(width, height, temporalDeduplication ? 768 : 0);
+	//A keyframe every 5 seconds, with a rolling refresh in between
+	encoder.KeyframeInterval() = 150;
+	encoder.IntraRefresh() = true;
+	//Each frame is due by the time the next one is captured
+	encoder.FrameBudget() = std::chrono::milliseconds(1000 / 30);
+
+	//The stream is decoded again for display, like a viewer would, into a surface which is kept from frame to frame so
+	//only the regions which changed are redrawn
+	ReferenceSet displayReferences(width, height, encoder.References().RecentFrames(), encoder.References().BackgroundDelay());
+	AsyncDecoder display(width, height, CompressedImage::Pool(), &displayReferences);
+	display.KeepSurfaces() = true;
+	cv::Mat decoded(height, width, CV_8UC3);
 
 	//std::ofstream file;
 	//file.open("test.csv");
@@ -86,11 +168,6 @@ int main()
 
 
 	while (true) {
-		//Flip the two images so we actually have a "prev"
-		auto tmp = img;
-		img = prev;
-		prev = tmp;
-
 		std::clock_t start = clock();
 
 		//Capture the frame
@@ -102,17 +179,10 @@ int main()
 		if (!frame.isContinuous())
 			return ErrorAndExit("Frame storage not contiguous!");
 
-		//Set the data as a simple gradient
-		img->SetData((BGRColor*)frame.data);
-
-		//Run a comparison
-		ImageDiff diff(*prev, *img, temporalDeduplication ? 768 : 0);
-		//And copy all the blocks from the old image
-		for (int y = 0; y < diff.RegionsTall(); y++)
-			for (int x = 0; x < diff.RegionsWide(); x++)
-				if (diff.AreSimilar(x, y)) {
-					img->GetRegion(x, y) = prev->GetRegion(x, y);
-				}
+		//Encode it (temporal deduplication against the previous frame happens in the encoder)
+		std::vector<uint8_t> serialized = encoder.EncodeFrame((BGRColor*)frame.data);
+		CompressedImage* img = &encoder.Image();
+		ImageDiff& diff = encoder.Differences();
 
 		double fps = 1 / durationSecs;
 		int dedupBlockCount, totalBlockCount, sizeBytes, sizeBytesNoDedup, totalRegions, deduplicatedRegions;
@@ -130,13 +200,34 @@ int main()
 		status << "After: " << (sizeBytes * fps) / 1024.0 / 1024.0 << "mb/s | ";
 		status << "W/o dedup: " << (sizeBytesNoDedup * fps) / 1024.0 / 1024.0 << "mb/s\n";
 		status << "Image Format: " << type2str(frame.type()) << "\n";
-		status << "Temporal Deduplication: " << (temporalDeduplication ? "on" : "off") << "\n";
-
-		Decoder::DecodeImageToBGRArray(*img, (BGRColor*)frame.data, width, height);
+		status << "Temporal Deduplication: " << (temporalDeduplication ? "on" : "off") << (encoder.IsKeyframe() ? " (keyframe)" : "") << (encoder.IsSceneChange() ? " (scene change)" : "") << "\n";
+		status << "Adaptive Block Sizes: " << (encoder.AdaptiveBlockSizes() ? "on" : "off") << " (press A)\n";
+		status << "Block Temporal Skip: " << (encoder.TemporalBlockSkip() ? "on" : "off") << " (press T)\n";
+		status << "Solid Blocks: " << (encoder.SolidBlocks() ? "on" : "off") << (img->SolidBlocks() ? " (in use)" : "") << " (press S)\n";
+		status << "YCoCg Colors: " << (encoder.YCoCgColors() ? "on" : "off") << " (press Y)\n";
+		status << "Long-term References: " << (encoder.LongTermReferences() ? "on" : "off") << " (press R)\n";
+		status << "Hold Deadlines: " << (encoder.HoldDeadlines() ? "on" : "off") << " (press D) | " << encoder.DeadlineMisses() << " missed, " << encoder.DegradedFrames() << " degraded";
+		status << " (" << encoder.RowsAtTier(StreamEncoder::TIER_FAST) << " fast, " << encoder.RowsAtTier(StreamEncoder::TIER_SKIP) << " skipped rows)\n";
+
+		display.SubmitFrame(serialized.data(), OutputSurface::BGR24((BGRColor*)decoded.data, width, height)).wait();
+		//The status goes over a copy, so it doesn't stay in the kept surface
+		decoded.copyTo(frame);
 		Print(status.str(), frame);
 		cv::imshow(windowName, frame);
 
 		int key = cv::waitKey(30);
+		if (key == 'a' || key == 'A')
+			encoder.AdaptiveBlockSizes() = !encoder.AdaptiveBlockSizes();
+		if (key == 't' || key == 'T')
+			encoder.TemporalBlockSkip() = !encoder.TemporalBlockSkip();
+		if (key == 's' || key == 'S')
+			encoder.SolidBlocks() = !encoder.SolidBlocks();
+		if (key == 'y' || key == 'Y')
+			encoder.YCoCgColors() = !encoder.YCoCgColors();
+		if (key == 'r' || key == 'R')
+			encoder.LongTermReferences() = !encoder.LongTermReferences();
+		if (key == 'd' || key == 'D')
+			encoder.HoldDeadlines() = !encoder.HoldDeadlines();
 
 		durationSecs = (std::clock() - start) / (double)CLOCKS_PER_SEC;
 